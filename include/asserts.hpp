@@ -25,6 +25,23 @@
 	)
 #endif
 
+namespace threading
+{
+	// True on the worker threads of a threading::pool. A failed assert there throws
+	// assert_failure instead of exiting, and the thread that handed out the work exits
+	// once the other workers are done with it.
+	bool on_pool_worker();
+	struct assert_failure {};
+}
+
+#define ASSERT_EXIT()																\
+	do {																			\
+		if(threading::on_pool_worker()) {											\
+			throw threading::assert_failure();										\
+		}																			\
+		exit(1);																	\
+	} while(0)
+
 #ifdef SERVER_BUILD
 #define ASSERT_LOG(_a,_b)															\
 	do {																			\
@@ -32,7 +49,7 @@
 			std::cerr << "CRITICAL: " << __SHORT_FORM_OF_FILE__ << ":" << __LINE__	\
 				<< " : " << _b << "\n";												\
 			DebuggerBreak();														\
-			exit(1);																\
+			ASSERT_EXIT();															\
 		}																			\
 	} while(0)
 
@@ -73,7 +90,7 @@
 			_s << __SHORT_FORM_OF_FILE__ << ":" << __LINE__ << " : " << _b;			\
 			SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "%s\n", _s.str().c_str());\
 			DebuggerBreak();														\
-			exit(1);																\
+			ASSERT_EXIT();															\
 		}																			\
 	} while(0)
 
@@ -0,0 +1,90 @@
+/*
+   Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "allocation_counter.hpp"
+
+#if defined(COUNT_ALLOCATIONS)
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	std::atomic<uint64_t> allocations(0);
+
+	void* counted_alloc(std::size_t sz)
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		// malloc(0) is allowed to return null, new isn't.
+		void* p = std::malloc(sz == 0 ? 1 : sz);
+		if(p == nullptr) {
+			throw std::bad_alloc();
+		}
+		return p;
+	}
+}
+
+namespace profile
+{
+	bool allocations_counted()
+	{
+		return true;
+	}
+
+	uint64_t allocation_count()
+	{
+		return allocations.load(std::memory_order_relaxed);
+	}
+}
+
+// Replacements for the global allocation functions, so that allocations can be counted.
+void* operator new(std::size_t sz)
+{
+	return counted_alloc(sz);
+}
+
+void* operator new[](std::size_t sz)
+{
+	return counted_alloc(sz);
+}
+
+void operator delete(void* p) throw()
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	std::free(p);
+}
+
+#else
+
+namespace profile
+{
+	bool allocations_counted()
+	{
+		return false;
+	}
+
+	uint64_t allocation_count()
+	{
+		return 0;
+	}
+}
+
+#endif
@@ -0,0 +1,30 @@
+/*
+   Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace profile
+{
+	// Allocations are only counted in builds with COUNT_ALLOCATIONS defined (make
+	// COUNT_ALLOCATIONS=yes), which replace the global operator new/delete. Other builds
+	// use the normal allocator and allocation_count() is always 0.
+	bool allocations_counted();
+	// Number of calls to the global operator new (and new[]) made so far, by any thread.
+	// Take the difference of two calls to count the allocations made by some code.
+	uint64_t allocation_count();
+}
@@ -0,0 +1,62 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+// --utility=analyze-map <map file> [output file] [centrality samples]
+// Works out the regions, chokepoints, clearance and centrality of a map (see
+// hex::map_analysis) and saves them. The output defaults to the map file with its extension
+// changed to .analysis. Add "analysis": "<output file>" to the map to have it loaded.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "asserts.hpp"
+#include "hex_logical_tiles.hpp"
+#include "hex_map_analysis.hpp"
+#include "json.hpp"
+#include "utility.hpp"
+
+namespace
+{
+	COMMAND_LINE_UTILITY("analyze-map")
+	{
+		ASSERT_LOG(!args.empty(), "Usage: --utility=analyze-map <map file> [output file] [centrality samples]");
+		const std::string& map_file = args[0];
+		std::string out_file;
+		if(args.size() > 1) {
+			out_file = args[1];
+		} else {
+			const auto dot = map_file.find_last_of('.');
+			const auto slash = map_file.find_last_of("/\\");
+			out_file = (dot == std::string::npos || (slash != std::string::npos && dot < slash) ? map_file : map_file.substr(0, dot)) + ".analysis";
+		}
+		const int samples = args.size() > 2 ? std::atoi(args[2].c_str()) : 64;
+
+		hex::logical::loader(json::parse_from_file("data/hex_tiles.cfg"));
+		auto m = hex::logical::map::factory(json::parse_from_file(map_file));
+
+		auto t1 = std::chrono::steady_clock::now();
+		hex::map_analysis analysis(*m, samples);
+		auto t2 = std::chrono::steady_clock::now();
+		analysis.write(out_file);
+
+		std::cout << map_file << ": " << m->width() << "x" << m->height() 
+			<< ", " << analysis.region_count() << " regions"
+			<< ", " << analysis.chokepoints().size() << " chokepoints"
+			<< ", in " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << "ms\n"
+			<< "Written to " << out_file << std::endl;
+	}
+}
@@ -0,0 +1,187 @@
+/*
+   Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// --utility=bench-paths [output file]
+// Times the path finding functions on each of the shipped maps, with a few different
+// densities of units placed on them. Results are written as JSON, to stdout if no file
+// is given. Allocations per call are only reported by builds made with
+// COUNT_ALLOCATIONS=yes.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+
+#include "allocation_counter.hpp"
+#include "asserts.hpp"
+#include "creature.hpp"
+#include "game_state.hpp"
+#include "hex_logical_tiles.hpp"
+#include "hex_pathfinding.hpp"
+#include "json.hpp"
+#include "node_utils.hpp"
+#include "units.hpp"
+#include "utility.hpp"
+
+namespace
+{
+	const int num_maps = 6;
+	const float densities[] = { 0.0f, 0.005f, 0.02f };
+	// Keeps the unit set up time sane on the big map.
+	const int max_units = 2000;
+	const int queries_per_layout = 200;
+
+	struct samples
+	{
+		std::vector<double> times_us;
+		uint64_t allocations;
+		samples() : allocations(0) {}
+
+		template<typename F>
+		void measure(F fn) {
+			const uint64_t a = profile::allocation_count();
+			auto t1 = std::chrono::steady_clock::now();
+			fn();
+			auto t2 = std::chrono::steady_clock::now();
+			allocations += profile::allocation_count() - a;
+			times_us.emplace_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() / 1000.0);
+		}
+
+		node summary() {
+			node_builder res;
+			if(times_us.empty()) {
+				return res.set("count", 0).build();
+			}
+			std::sort(times_us.begin(), times_us.end());
+			auto percentile = [this](double p) {
+				return times_us[std::min(static_cast<size_t>(p * times_us.size()), times_us.size() - 1)];
+			};
+			double total = 0;
+			for(auto t : times_us) {
+				total += t;
+			}
+			res.set("count", static_cast<int>(times_us.size()));
+			res.set("p50_us", percentile(0.5));
+			res.set("p99_us", percentile(0.99));
+			res.set("mean_us", total / times_us.size());
+			if(profile::allocations_counted()) {
+				res.set("allocations_per_call", static_cast<double>(allocations) / times_us.size());
+			}
+			return res.build();
+		}
+	};
+
+	node bench_layout(const hex::logical::map_ptr& m, float density, std::mt19937& rng)
+	{
+		game::state gs;
+		gs.set_map(m);
+		auto ta = gs.create_team_instance("a");
+		auto tb = gs.create_team_instance("b");
+		auto pa = std::make_shared<player>(ta, PlayerType::NORMAL, "a");
+		auto pb = std::make_shared<player>(tb, PlayerType::NORMAL, "b");
+		gs.add_player(pa);
+		gs.add_player(pb);
+
+		// Unit positions are spread uniformly, alternating between the two teams. There is
+		// always at least one unit of ours to start searches from.
+		const int tiles = m->width() * m->height();
+		const int nunits = std::max(1, std::min(max_units, static_cast<int>(tiles * density)));
+		std::uniform_int_distribution<int> xdist(0, m->width() - 1);
+		std::uniform_int_distribution<int> ydist(0, m->height() - 1);
+		std::set<point> used;
+		game::unit_list ours;
+		for(int n = 0; n != nunits && static_cast<int>(used.size()) < tiles; ) {
+			point p(xdist(rng), ydist(rng));
+			if(!used.insert(p).second) {
+				continue;
+			}
+			auto u = gs.create_unit_instance("goblin", n % 2 ? pb : pa, p);
+			gs.add_unit(u);
+			if(n % 2 == 0) {
+				ours.emplace_back(u);
+			}
+			++n;
+		}
+
+		samples create_cost_graph, available_moves, find_path;
+		hex::result_path path;
+		for(int q = 0; q != queries_per_layout; ++q) {
+			auto& u = ours[q % ours.size()];
+			hex::hex_graph_ptr g;
+			hex::result_list moves;
+			create_cost_graph.measure([&]() {
+				g = hex::create_cost_graph(gs, ta, u->get_position(), u->get_move());
+			});
+			available_moves.measure([&]() {
+				moves = hex::find_available_moves(g, u->get_position(), u->get_move());
+			});
+			if(!moves.empty()) {
+				std::uniform_int_distribution<int> mdist(0, static_cast<int>(moves.size()) - 1);
+				const point dst = moves[mdist(rng)].loc;
+				find_path.measure([&]() {
+					hex::find_path(*g, u->get_position(), dst, &path);
+				});
+			}
+		}
+
+		node_builder res;
+		res.set("density", static_cast<double>(density));
+		res.set("units", nunits);
+		res.set("create_cost_graph", create_cost_graph.summary());
+		res.set("find_available_moves", available_moves.summary());
+		res.set("find_path", find_path.summary());
+		return res.build();
+	}
+
+	COMMAND_LINE_UTILITY("bench-paths")
+	{
+		hex::logical::loader(json::parse_from_file("data/hex_tiles.cfg"));
+		creature::loader(json::parse_from_file("data/units.cfg"));
+
+		// Fixed seed so that runs can be compared.
+		std::mt19937 rng(12345);
+		node_list maps;
+		for(int n = 1; n <= num_maps; ++n) {
+			std::stringstream name;
+			name << "data/maps/map" << n << ".cfg";
+			auto m = hex::logical::map::factory(json::parse_from_file(name.str()));
+			LOG_INFO("bench-paths: " << name.str() << " " << m->width() << "x" << m->height());
+
+			node_list layouts;
+			for(auto density : densities) {
+				layouts.emplace_back(bench_layout(m, density, rng));
+			}
+			node_builder mb;
+			mb.set("map", name.str());
+			mb.set("width", m->width());
+			mb.set("height", m->height());
+			mb.set("layouts", node(layouts));
+			maps.emplace_back(mb.build());
+		}
+		node res = node_builder().set("maps", node(maps)).build();
+
+		if(args.empty()) {
+			std::cout << res.write_json() << std::endl;
+		} else {
+			std::ofstream out(args.front());
+			ASSERT_LOG(out.is_open(), "Couldn't open " << args.front() << " for writing.");
+			out << res.write_json();
+		}
+	}
+}
@@ -20,7 +20,10 @@
 #include "bot.hpp"
 #include "creature.hpp"
 #include "game_state.hpp"
+#include "hex_distance_batch.hpp"
 #include "hex_logical_tiles.hpp"
+#include "hex_map_analysis.hpp"
+#include "hex_path_abstraction.hpp"
 #include "hex_pathfinding.hpp"
 #include "message_format.pb.h"
 #include "profile_timer.hpp"
@@ -92,73 +95,135 @@ namespace ai
 		LOG_DEBUG("Running bot for " << u);
 
 		// Find available moves for current unit.
-		auto g = hex::create_cost_graph(gs, u->get_position(), u->get_move());
-		auto possible_moves = hex::find_available_moves(g, u->get_position(), u->get_move());
+		auto reach = gs.get_reachable_moves(u);
+		auto g = reach->graph;
+		auto& possible_moves = reach->moves;
+		LOG_DEBUG("Reachability cache: " << gs.get_reachability_cache().hits() << " hits, " 
+			<< gs.get_reachability_cache().misses() << " misses, " 
+			<< gs.get_reachability_cache().invalidations() << " invalidations");
 
-		// Calculate the closest enemy and move towards them
-		game::unit_ptr closest_enemy = nullptr;
-		int closest_distance = std::numeric_limits<int>::max();
+		// Find the cheapest place to attack each enemy from this turn, in one search.
+		game::unit_list enemies;
+		hex::position_list enemy_positions;
 		for(auto& enemy : gs.get_entities()) {
 			// XXX we should come up with a faster access for the team id, maybe add it directly as a member of component_set_ptr
 			if(enemy->get_owner()->team() != u->get_owner()->team()) {
-				if(closest_enemy == nullptr) {
-					closest_enemy = enemy;
-					closest_distance = hex::logical::distance(u->get_position(), enemy->get_position());
-				} else {
-					int d = hex::logical::distance(u->get_position(), enemy->get_position());
-					if(d < closest_distance) {
-						closest_enemy = enemy;
-						closest_distance = d;
-					}
-				}
+				enemies.emplace_back(enemy);
+				enemy_positions.add(enemy->get_position());
+			}
+		}
+		auto attack_positions = hex::find_attack_positions(g, u->get_position(), u->get_move(), u->get_range(), enemies, gs.get_occupancy());
+		const hex::attack_position* best = nullptr;
+		for(auto& ap : attack_positions) {
+			if(best == nullptr || ap.path_cost < best->path_cost) {
+				best = &ap;
 			}
 		}
-		// Found an enemy, try and get as close as possible.
-		point dest;
-		bool got_location = false;
+
 		hex::result_path rp;
-		if(closest_enemy && closest_distance > u->get_range()) {
-			auto surrounds = gs.get_map()->get_surrounding_positions(closest_enemy->get_position());
-			for(auto& p : possible_moves) {
-				for(auto& sp : surrounds) {
-					if(p.loc == sp) {
-						// We found a match.
+		if(best != nullptr) {
+			LOG_DEBUG("Attacking " << best->target << " from " << best->loc);
+			rp = best->path;
+		} else if(!enemies.empty()) {
+			// Nothing we can attack this turn, so head towards the closest enemy.
+			game::unit_ptr closest_enemy = enemies[hex::closest(u->get_position(), enemy_positions)];
+
+			// Follow the path we've been keeping towards the enemy as far as we can this turn.
+			point dest;
+			bool got_location = false;
+			auto pursuit = gs.find_pursuit_path(u, closest_enemy->get_position());
+			for(auto it = pursuit.rbegin(); it != pursuit.rend() && !got_location; ++it) {
+				for(auto& p : possible_moves) {
+					if(p.loc == *it && p.loc != u->get_position()) {
 						got_location = true;
-						dest = sp;
+						dest = p.loc;
 						break;
 					}
 				}
 			}
 
-			// Did we find a location of enemy within our list of possible moves?
-			if(got_location) {
-				rp = hex::find_path(g, u->get_position(), dest);
-			} else {
-				// Nope. Then we need to find the tile that is closest and move there.
-				int closest_d = std::numeric_limits<int>::max();
-				point closest_pos;
+			// Failing that, use the long range route.
+			hex::path_abstraction::route route;
+			if(!got_location) {
+				route = gs.get_path_abstraction().find_route(u->get_position(), closest_enemy->get_position());
+			}
+			point target = closest_enemy->get_position();
+			for(auto it = route.first_leg.rbegin(); it != route.first_leg.rend() && !got_location; ++it) {
+				for(auto& p : possible_moves) {
+					if(p.loc == *it && p.loc != u->get_position()) {
+						got_location = true;
+						dest = p.loc;
+						break;
+					}
+				}
+			}
+			if(got_location && !route.first_leg.empty() && dest == route.first_leg.back()) {
+				// We can get past the first waypoint, so head for the one after it instead.
+				got_location = false;
+				if(route.waypoints.size() > 2) {
+					target = route.waypoints[2];
+				}
+			}
+			if(!got_location) {
+				// Then we need to find the tile that is closest and move there. Of the closest
+				// tiles pick the one that the fewest enemies can attack on their next turn.
+				auto& m = *gs.get_map();
+				std::vector<int> threat(m.size());
+				// Which enemy last counted each tile, so tiles in range of more than one of its
+				// moves are counted once.
+				std::vector<int> counted_by(m.size(), -1);
+				std::vector<hex::move_request> requests;
+				for(auto& enemy : enemies) {
+					requests.emplace_back(enemy->get_position(), enemy->get_type()->get_movement(), enemy->get_owner()->team());
+				}
+				auto enemy_reach = hex::find_all_available_moves(hex::search_view(gs), requests);
+				for(int n = 0; n != static_cast<int>(enemies.size()); ++n) {
+					const int range = enemies[n]->get_range();
+					for(auto& mv : enemy_reach[n].moves) {
+						for(auto& p : hex::logical::spiral(mv.loc, range)) {
+							if(m.in_bounds(p) && counted_by[m.index(p)] != n) {
+								counted_by[m.index(p)] = n;
+								++threat[m.index(p)];
+							}
+						}
+					}
+				}
+
+				hex::position_list move_positions;
 				for(auto& p : possible_moves) {
-					int d = hex::logical::distance(p.loc, closest_enemy->get_position());
-					if(d < closest_d) {
+					move_positions.add(p.loc);
+				}
+				std::vector<int> move_distances;
+				hex::distances(target, move_positions, &move_distances);
+				// If the map has been analysed, stay out of chokepoints when nothing else decides it,
+				// so we don't block the way for the rest of the team.
+				auto& analysis = gs.get_map()->get_analysis();
+				int closest_d = std::numeric_limits<int>::max();
+				int least_threat = std::numeric_limits<int>::max();
+				bool in_chokepoint = true;
+				for(int n = 0; n != move_positions.size(); ++n) {
+					const int d = move_distances[n];
+					const int t = threat[m.index(possible_moves[n].loc)];
+					const bool choke = analysis != nullptr && analysis->is_chokepoint(possible_moves[n].loc);
+					if(d < closest_d || (d == closest_d && (t < least_threat || (t == least_threat && in_chokepoint && !choke)))) {
 						closest_d = d;
-						closest_pos = p.loc;
+						least_threat = t;
+						in_chokepoint = choke;
+						dest = possible_moves[n].loc;
 					}
 				}
-				rp = hex::find_path(g, u->get_position(), closest_pos);
-				got_location = true;
 			}
+			rp = hex::find_path(g, u->get_position(), dest);
 		}
 
-		ASSERT_LOG(got_location || closest_distance <= u->get_range(), "Programmer error: No location for destination.");
-
 		// Choose random destination
 		//int x = generator::get_uniform_int<int>(0, static_cast<int>(possible_moves.size()));
 		//auto rp = hex::find_path(g, e->pos.gs_pos, possible_moves[x].loc);
 
 		// Random move unit.
 		game::Update* up = gs.create_update();
-		// No need to move if there is a unit next to us.
-		if(closest_distance > u->get_range()) {
+		// No need to move if we can already attack from where we are.
+		if(rp.size() > 1) {
 			gs.unit_move(up, u, rp);
 		}
 		
@@ -166,7 +231,8 @@ namespace ai
 		//while(e->stat->attacks_this_turn > 0) {
 			std::vector<game::unit_ptr> attackable;
 			int max_attacks = u->get_type()->get_max_units_attackable();
-			for(auto& ae : gs.get_entities()) {
+			// Only units in range of where u ended up need the full check.
+			for(auto& ae : gs.get_units_in_range(u->get_position(), u->get_range())) {
 				if(gs.is_attackable(u, ae)) {
 					attackable.emplace_back(ae);
 					if(--max_attacks == 0) {
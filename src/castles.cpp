@@ -21,7 +21,8 @@
 #include "castles.hpp"
 #include "enum_iterator.hpp"
 #include "hex_fwd.hpp"
-#include "hex_object.hpp"
+#include "hex_map.hpp"
+#include "hex_tile.hpp"
 #include "json.hpp"
 #include "node_utils.hpp"
 #include "surface.hpp"
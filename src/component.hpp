@@ -97,12 +97,17 @@ namespace component
 		bool is_attack_target;
 		hex::result_list possible_moves;
 		hex::hex_graph_ptr graph;
+		// Search tree that possible_moves came from, so paths to them don't need another search.
+		std::vector<int> move_pred;
+		std::vector<hex::fixed_cost> move_dist;
 		std::vector<point> arrow_path;
 		std::vector<point> tile_path;
 		void clear() {
 			selected = false;
 			possible_moves.clear();
 			graph.reset();
+			move_pred.clear();
+			move_dist.clear();
 			arrow_path.clear();
 			tile_path.clear();
 			clear_selection = false;
@@ -53,6 +53,7 @@ component_set_ptr engine::add_entity(component_set_ptr e)
 {
 	entity_list_.emplace_back(e);
 	std::stable_sort(entity_list_.begin(), entity_list_.end());
+	index_entity(e);
 	return e;
 }
 
@@ -61,6 +62,24 @@ void engine::remove_entity(component_set_ptr e1)
 	entity_list_.erase(std::remove_if(entity_list_.begin(), entity_list_.end(), [&e1](component_set_ptr e2) {
 		return e1 == e2; 
 	}), entity_list_.end());
+	unindex_entity(e1);
+}
+
+void engine::index_entity(const component_set_ptr& e)
+{
+	if((e->mask & genmask(Component::STATS)) == genmask(Component::STATS) && e->stat != nullptr) {
+		unit_entities_[e->stat->get_uuid()] = e;
+	}
+}
+
+void engine::unindex_entity(const component_set_ptr& e)
+{
+	if((e->mask & genmask(Component::STATS)) == genmask(Component::STATS) && e->stat != nullptr) {
+		auto it = unit_entities_.find(e->stat->get_uuid());
+		if(it != unit_entities_.end() && it->second == e) {
+			unit_entities_.erase(it);
+		}
+	}
 }
 
 void engine::add_process(process::process_ptr s)
@@ -213,6 +232,7 @@ void engine::entity_health_check()
 	entity_list_.erase(std::remove_if(entity_list_.begin(), entity_list_.end(), [&](component_set_ptr e) {
 		if((e->mask & stat_mask) == stat_mask) {
 			if(e->stat->get_health() <= 0) {
+				unindex_entity(e);
 				return true;
 			}
 		}
@@ -247,6 +267,7 @@ bool engine::update(double time)
 		if(e->lifetime > DBL_EPSILON) {
 			e->lifetime -= time;
 			if(e->lifetime < DBL_EPSILON) {
+				unindex_entity(e);
 				return true;
 			}
 		}
@@ -258,13 +279,9 @@ bool engine::update(double time)
 
 component_set_ptr engine::get_entity_for_unit_uuid(const uuid::uuid& id) const
 {
-	// This is a linear search through entities. Should see if there is a more efficient
-	// way of doing it if performace is a bottleneck.
-	auto it = std::find_if(entity_list_.begin(), entity_list_.end(), [&id](const component_set_ptr& cs) {
-		return ((cs->mask & genmask(Component::STATS)) == genmask(Component::STATS) && cs->stat->get_uuid() == id) ? true : false;
-	});
-	ASSERT_LOG(it != entity_list_.end(), "Unable to find entity with unit id: " << id);
-	return *it;
+	auto it = unit_entities_.find(id);
+	ASSERT_LOG(it != unit_entities_.end(), "Unable to find entity with unit id: " << id);
+	return it->second;
 }
 
 // Handle the engine side of game::state updates
@@ -416,6 +433,14 @@ void engine::process_update(game::Update* up)
 				inp->gen_moves = true;
 			}
 		}
+		// Work out the move ranges for all our units in one go, so they're ready to be shown.
+		game::unit_list our_units;
+		for(auto& u : game_state_.get_entities()) {
+			if(u->get_owner() == active_player_) {
+				our_units.emplace_back(u);
+			}
+		}
+		game_state_.prefetch_reachable_moves(our_units);
 	}
 
 	// Check for a game won/drawn/lost
@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <unordered_map>
+
 #include "engine_fwd.hpp"
 #include "game_state.hpp"
 #include "geometry.hpp"
@@ -113,6 +115,8 @@ private:
 	unsigned camera_scale_;
 	graphics::window_manager& wm_;
 	entity_list entity_list_;
+	// Entities with stats, by the id of their unit.
+	std::unordered_map<uuid::uuid, component_set_ptr, uuid::hash> unit_entities_;
 	std::vector<process::process_ptr> process_list_;
 	point tile_size_;
 	rect extents_;
@@ -130,6 +134,9 @@ private:
 
 	void entity_health_check();
 
+	void index_entity(const component_set_ptr& e);
+	void unindex_entity(const component_set_ptr& e);
+
 	engine() = delete;
 	engine(const engine&) = delete;
 	void operator=(const engine&) = delete;
@@ -14,13 +14,22 @@
    limitations under the License.
 */
 
+#include <algorithm>
+#include <sstream>
+
 #include "asserts.hpp"
 #include "creature.hpp"
 #include "formatter.hpp"
 #include "game_state.hpp"
+#include "hex_incremental_planner.hpp"
+#include "hex_line_of_sight.hpp"
 #include "hex_logical_tiles.hpp"
+#include "hex_path_abstraction.hpp"
+#include "hex_pathfinding.hpp"
+#include "json.hpp"
 #include "profile_timer.hpp"
 #include "random.hpp"
+#include "unit_test.hpp"
 #include "units.hpp"
 #include "uuid.hpp"
 
@@ -28,25 +37,36 @@ namespace game
 {
 	state::state()
 		: initiative_counter_(0.0f),
-		  update_counter_(0)
+		  update_counter_(0),
+		  map_revision_(0),
+		  reachability_(std::make_shared<hex::reachability_cache>())
 	{
 	}
 
 	state::state(const state& obj)
 		: initiative_counter_(obj.initiative_counter_),
 		  update_counter_(obj.update_counter_),
-		  map_(obj.map_->clone())
+		  map_(obj.map_->clone()),
+		  graph_(obj.graph_),
+		  map_revision_(obj.map_revision_),
+		  reachability_(std::make_shared<hex::reachability_cache>()),
+		  abstraction_(obj.abstraction_)
 	{
 		for(auto& p : obj.players_) {
 			players_[p.first] = p.second->clone();
 		}
-		for(auto& u : obj.units_) {
+		unit_list units;
+		std::vector<int> handles;
+		for(auto& u : obj.schedule_.units()) {
 			auto owner = u->get_owner();
 			ASSERT_LOG(owner != nullptr, "Couldn't lock owner of " << u);
 			auto it = players_.find(owner->get_uuid());
 			ASSERT_LOG(it != players_.end(), "Couldn't find owner for " << u);
-			units_.emplace_back(u->clone(it->second));
+			units.emplace_back(u->clone(it->second));
+			handles.emplace_back(index_unit(units.back()));
 		}
+		schedule_.copy_order(obj.schedule_, units, handles);
+		rebuild_unit_indexes();
 	}
 
 	state::~state()
@@ -56,6 +76,69 @@ namespace game
 	void state::set_map(hex::logical::map_ptr map)
 	{
 		map_ = map;
+		graph_ = map_ ? std::make_shared<hex::map_graph>(*map_) : nullptr;
+		map_revision_ = map_ ? map_->revision() : 0;
+		reachability_->clear();
+		abstraction_.reset();
+		pursuit_.reset();
+		rebuild_unit_indexes();
+	}
+
+	void state::rebuild_unit_indexes()
+	{
+		if(map_ == nullptr) {
+			occupancy_.reset(0, 0, 0, 0);
+			zoc_.reset(0, 0, 0, 0);
+			return;
+		}
+		occupancy_.reset(map_->x(), map_->y(), map_->width(), map_->height());
+		zoc_.reset(map_->x(), map_->y(), map_->width(), map_->height());
+		for(auto& u : schedule_.units()) {
+			auto& t = u->get_owner()->team();
+			occupancy_.add(u, t, u->get_position());
+			zoc_.add(t.get(), u->get_position());
+		}
+	}
+
+	void state::sync_map() const
+	{
+		if(map_ == nullptr || map_->revision() == map_revision_) {
+			return;
+		}
+		// The graph may be shared with copies of this state, so it's replaced rather than
+		// changed. That's cheap, the new graph shares the map's tiles.
+		auto changes = map_->get_changes_since(map_revision_);
+		for(auto& p : changes) {
+			reachability_->tile_changed(p);
+		}
+		graph_ = std::make_shared<hex::map_graph>(*map_);
+		map_revision_ = map_->revision();
+		if(abstraction_ != nullptr) {
+			// Only copied if a copy of this state is still using it.
+			if(abstraction_.use_count() > 1) {
+				abstraction_ = std::make_shared<hex::path_abstraction>(*abstraction_);
+			}
+			abstraction_->tiles_changed(graph_, changes);
+		}
+		if(pursuit_ != nullptr) {
+			pursuit_->tiles_changed(graph_, changes);
+		}
+	}
+
+	const hex::map_graph_ptr& state::get_graph() const
+	{
+		sync_map();
+		return graph_;
+	}
+
+	const hex::path_abstraction& state::get_path_abstraction() const
+	{
+		ASSERT_LOG(map_ != nullptr, "No map set while building the path abstraction.");
+		sync_map();
+		if(abstraction_ == nullptr) {
+			abstraction_ = std::make_shared<hex::path_abstraction>(graph_);
+		}
+		return *abstraction_;
 	}
 
 	unit_ptr state::create_unit_instance(const std::string& type, const player_ptr& pid, const point& pos)
@@ -65,38 +148,111 @@ namespace game
 
 	void state::add_unit(unit_ptr e)
 	{
-		units_.emplace_back(e);
-		std::stable_sort(units_.begin(), units_.end(), initiative_compare);
+		schedule_.push(index_unit(e), e);
+		place_unit(e);
+	}
+
+	void state::place_unit(const unit_ptr& e)
+	{
+		occupancy_.add(e, e->get_owner()->team(), e->get_position());
+		zoc_.add(e->get_owner()->team().get(), e->get_position());
+		reachability_->unit_changed(e->get_position());
+		if(pursuit_ != nullptr) {
+			pursuit_->occupant_changed(e->get_position());
+		}
 	}
 
 	void state::remove_unit(unit_ptr e1)
 	{
-		units_.erase(std::remove_if(units_.begin(), units_.end(), [&e1](unit_ptr e2) {
-			return e1 == e2; 
-		}), units_.end());
+		const int handle = unindex_unit(e1);
+		if(handle < 0) {
+			// Already gone.
+			return;
+		}
+		schedule_.erase(handle);
+		occupancy_.remove(e1, e1->get_position());
+		zoc_.remove(e1->get_owner()->team().get(), e1->get_position());
+		reachability_->remove(e1->get_uuid());
+		reachability_->unit_changed(e1->get_position());
+		if(pursuit_ != nullptr) {
+			pursuit_->remove(e1->get_uuid());
+			pursuit_->occupant_changed(e1->get_position());
+		}
+	}
+
+	void state::set_unit_position(const unit_ptr& u, const point& p) const
+	{
+		reachability_->unit_changed(u->get_position());
+		if(pursuit_ != nullptr) {
+			pursuit_->occupant_changed(u->get_position());
+			pursuit_->occupant_changed(p);
+		}
+		auto& t = u->get_owner()->team();
+		occupancy_.move(u, t, u->get_position(), p);
+		zoc_.move(t.get(), u->get_position(), p);
+		u->set_position(p);
+		reachability_->unit_changed(p);
+	}
+
+	hex::result_path state::find_pursuit_path(const unit_ptr& u, const point& goal) const
+	{
+		sync_map();
+		if(pursuit_ == nullptr) {
+			pursuit_ = std::make_shared<hex::pursuit_planners>(*this);
+		}
+		return pursuit_->find_path(u, goal);
+	}
+
+	int state::get_pursuit_expanded(const unit_ptr& u) const
+	{
+		return pursuit_ != nullptr ? pursuit_->expanded(u) : 0;
+	}
+
+	hex::reachable_moves_ptr state::get_reachable_moves(const unit_ptr& u) const
+	{
+		// Map edits since the last search need to have been seen by the cache first.
+		sync_map();
+		return reachability_->get(*this, u);
+	}
+
+	unit_list state::get_units_in_range(const point& p, int range) const
+	{
+		unit_list res;
+		occupancy_.for_each_in_range(p, range, [&res](const unit_ptr& u) {
+			res.emplace_back(u);
+		});
+		return res;
+	}
+
+	void state::prefetch_reachable_moves(const unit_list& units) const
+	{
+		sync_map();
+		reachability_->prefetch(*this, units);
 	}
 
 	void state::end_unit_turn(Update* up)
 	{
 		up->set_end_turn(true);
-		if(units_.size() > 0) {
-			auto& old_unit = units_.front();
+		if(!schedule_.empty()) {
+			const unit_ptr old_unit = schedule_.front();
 			auto ou = up->add_units();
 			ou->set_uuid(uuid::write(old_unit->get_uuid()));
 			Update_UnitStats* uus = new Update_UnitStats();
 			old_unit->complete_turn(uus);
 			ou->set_allocated_stats(uus);
 
-			std::stable_sort(units_.begin(), units_.end(), initiative_compare);
-			initiative_counter_ = units_.front()->get_initiative();
+			const int handle = get_unit_handle(old_unit->get_uuid());
+			schedule_.reschedule(handle);
+			initiative_counter_ = schedule_.front()->get_initiative();
 
 			up->set_initiative_counter(initiative_counter_);
-			for(auto& u : units_) {
-				auto order = up->add_ordering();
-				*order = uuid::write(u->get_uuid());
-			}
+			// Only the unit that just finished its turn has moved, so that's all clients need.
+			auto sch = up->add_schedule();
+			sch->set_uuid(uuid::write(old_unit->get_uuid()));
+			sch->set_initiative(old_unit->get_initiative());
+			sch->set_sequence(schedule_.sequence(handle));
 
-			auto& new_unit = units_.front();
+			auto& new_unit = schedule_.front();
 			auto nu = up->add_units();
 			nu->set_uuid(uuid::write(new_unit->get_uuid()));
 			Update_UnitStats* nus = new Update_UnitStats();
@@ -105,6 +261,115 @@ namespace game
 		}
 	}
 
+	state::unit_snapshot state::snapshot(const unit_ptr& u) const
+	{
+		unit_snapshot s;
+		s.handle = get_unit_handle(u->get_uuid());
+		s.pos = u->get_position();
+		s.move = u->get_move();
+		s.initiative = u->get_initiative();
+		s.health = u->get_health();
+		s.attacks_this_turn = u->get_attacks_this_turn();
+		return s;
+	}
+
+	void state::restore(const unit_snapshot& s)
+	{
+		auto& u = get_unit_by_handle(s.handle);
+		if(u->get_position() != s.pos) {
+			set_unit_position(u, s.pos);
+		}
+		u->set_move(s.move);
+		u->set_initiative(s.initiative);
+		u->set_health(s.health);
+		u->set_attacks_this_turn(s.attacks_this_turn);
+	}
+
+	void state::make_move(const unit_ptr& u, const std::vector<point>& path)
+	{
+		ASSERT_LOG(!path.empty(), "Empty path given for " << u);
+		undo_entry entry;
+		entry.type = undo_entry::Type::MOVE;
+		entry.unit = snapshot(u);
+		undo_log_.emplace_back(std::move(entry));
+
+		const hex::fixed_cost cost = hex::path_cost(*get_graph(), path);
+		set_unit_position(u, path.back());
+		u->set_move(hex::from_fixed_cost(hex::to_fixed_cost(u->get_move()) - cost));
+	}
+
+	void state::make_attack(const unit_ptr& aggressor, const unit_ptr& target, bool critical)
+	{
+		undo_entry entry;
+		entry.type = undo_entry::Type::ATTACK;
+		entry.unit = snapshot(aggressor);
+		entry.target = snapshot(target);
+		entry.target_sequence = schedule_.sequence(entry.target.handle);
+		entry.next_sequence = schedule_.next_sequence();
+		entry.low_sequence = schedule_.low_sequence();
+		undo_log_.emplace_back(std::move(entry));
+
+		if(aggressor->get_attacks_this_turn() <= 0) {
+			return;
+		}
+		if(aggressor->get_attack() > target->get_armour()) {
+			target->set_health(target->get_health() - (aggressor->get_attack() - target->get_armour()) * (critical ? 2 : 1));
+		}
+		aggressor->dec_attacks_this_turn();
+		if(target->get_health() <= 0) {
+			undo_log_.back().dead_target = target;
+			remove_unit(target);
+		}
+	}
+
+	void state::make_end_turn()
+	{
+		ASSERT_LOG(!schedule_.empty(), "No units to end the turn of.");
+		const unit_ptr u = schedule_.front();
+		undo_entry entry;
+		entry.type = undo_entry::Type::END_TURN;
+		entry.unit = snapshot(u);
+		entry.unit_sequence = schedule_.sequence(entry.unit.handle);
+		entry.next_sequence = schedule_.next_sequence();
+		entry.low_sequence = schedule_.low_sequence();
+		entry.initiative_counter = initiative_counter_;
+		undo_log_.emplace_back(std::move(entry));
+
+		u->complete_turn();
+		schedule_.reschedule(undo_log_.back().unit.handle);
+		initiative_counter_ = schedule_.front()->get_initiative();
+	}
+
+	void state::undo()
+	{
+		ASSERT_LOG(!undo_log_.empty(), "Nothing to undo.");
+		undo_entry& entry = undo_log_.back();
+		switch(entry.type) {
+			case undo_entry::Type::MOVE:
+				restore(entry.unit);
+				break;
+			case undo_entry::Type::ATTACK:
+				if(entry.dead_target != nullptr) {
+					const int handle = index_unit(entry.dead_target, entry.target.handle);
+					schedule_.restore(handle, entry.dead_target, entry.target_sequence);
+					place_unit(entry.dead_target);
+				}
+				restore(entry.target);
+				restore(entry.unit);
+				break;
+			case undo_entry::Type::END_TURN:
+				restore(entry.unit);
+				schedule_.reschedule(entry.unit.handle, entry.unit_sequence);
+				initiative_counter_ = entry.initiative_counter;
+				break;
+		}
+		if(entry.type != undo_entry::Type::MOVE) {
+			schedule_.set_next_sequence(entry.next_sequence);
+			schedule_.set_low_sequence(entry.low_sequence);
+		}
+		undo_log_.pop_back();
+	}
+
 	void state::add_player(player_ptr p)
 	{
 		players_[p->get_uuid()] = p;
@@ -123,7 +388,7 @@ namespace game
 		ASSERT_LOG(it != players_.end(), "Attempted to remove player " << to_be_replaced->name() << " failed, player doesn't exist.");
 
 		// need to change the player in all entities.
-		for(auto& u : units_) {
+		for(auto& u : schedule_.units()) {
 			auto owner = u->get_owner();
 			if(owner == it->second) {
 				u->set_owner(replacement);
@@ -133,6 +398,10 @@ namespace game
 		// remove player from list and add replacement.
 		players_.erase(it);
 		players_[replacement->get_uuid()] = replacement;
+		// the replacement may be on a different team.
+		rebuild_unit_indexes();
+		reachability_->clear();
+		pursuit_.reset();
 	}
 
 	player_ptr state::get_player(const uuid::uuid& n)
@@ -145,8 +414,8 @@ namespace game
 	player_ptr state::get_current_player() const
 	{
 		// XXX strictly this isn't an error and i need a better way of dealing with it.
-		ASSERT_LOG(units_.size() > 0, "No current units.");
-		return units_.front()->get_owner();
+		ASSERT_LOG(!schedule_.empty(), "No current units.");
+		return schedule_.front()->get_owner();
 	}
 
 	std::vector<player_ptr> state::get_players()
@@ -183,16 +452,15 @@ namespace game
 		Update_Unit *unit = up->add_units();
 		unit->set_uuid(uuid::write(u->get_uuid()));
 		unit->set_type(Update_Unit_MessageType::Update_Unit_MessageType_MOVE);
-		float cost(0);
 		for(auto& p : path) {
 			Update_Location* loc = unit->add_path();
 			loc->set_x(p.x);
 			loc->set_y(p.y);
-			cost -= map_->get_tile_at(p)->get_cost();
 		}
-		// Set the game state position.
-		u->set_position(path.back());
-		u->set_move(u->get_move() - cost);
+		// Set the game state position. The cost is worked out in the same way as the server does.
+		const hex::fixed_cost cost = hex::path_cost(*get_graph(), path);
+		set_unit_position(u, path.back());
+		u->set_move(hex::from_fixed_cost(hex::to_fixed_cost(u->get_move()) - cost));
 		return *this;
 	}
 
@@ -315,14 +583,14 @@ namespace game
 		}
 
 		// Check for victory condition -- assumes it is one side losing all their units.
-		if(units_.size() == 0) {
+		if(schedule_.empty()) {
 			// all units killed during this turn -- calling it a draw.
 			nup->set_game_win_state(Update_GameWinState_DRAW);
 		} else {
 			// check to see if all entities on one side are dead.
 			// XXX this feels like a horrble over-kill hacky way of doing it.
 			std::map<uuid::uuid,int> score;
-			for(auto& e : units_) { 
+			for(auto& e : schedule_.units()) { 
 				const uuid::uuid& id = e->get_owner()->team()->id();
 				auto it = score.find(id);
 				if(it == score.end()) {
@@ -331,7 +599,7 @@ namespace game
 					(it->second)++;
 				}
 			}
-			team_ptr winning_team = units_.front()->get_owner()->team();
+			team_ptr winning_team = schedule_.front()->get_owner()->team();
 			if(score.size() == 1) {
 				nup->set_winning_team_uuid(uuid::write(winning_team->id()));
 				nup->set_game_win_state(Update_GameWinState_WON);
@@ -340,13 +608,63 @@ namespace game
 		return nup;
 	}
 
-	unit_ptr state::get_unit_by_uuid(const uuid::uuid& id)
+	const unit_ptr& state::get_unit_by_uuid(const uuid::uuid& id) const
 	{
-		auto it = std::find_if(units_.begin(), units_.end(), [&id](unit_ptr u){
-			return u->get_uuid() == id;
-		});
-		ASSERT_LOG(it != units_.end(), "Couldn't find unit with uuid: " << uuid::write(id));
-		return *it;
+		auto& u = find_unit(id);
+		ASSERT_LOG(u != nullptr, "Couldn't find unit with uuid: " << uuid::write(id));
+		return u;
+	}
+
+	const unit_ptr& state::find_unit(const uuid::uuid& id) const
+	{
+		static const unit_ptr none;
+		auto it = unit_handles_.find(id);
+		return it == unit_handles_.end() ? none : handle_units_[it->second];
+	}
+
+	int state::get_unit_handle(const uuid::uuid& id) const
+	{
+		auto it = unit_handles_.find(id);
+		return it == unit_handles_.end() ? -1 : it->second;
+	}
+
+	const unit_ptr& state::get_unit_by_handle(int handle) const
+	{
+		ASSERT_LOG(handle >= 0 && handle < static_cast<int>(handle_units_.size()) && handle_units_[handle] != nullptr, "Bad unit handle: " << handle);
+		return handle_units_[handle];
+	}
+
+	int state::index_unit(const unit_ptr& u, int handle)
+	{
+		ASSERT_LOG(unit_handles_.find(u->get_uuid()) == unit_handles_.end(), "Unit added twice: " << u);
+		if(handle >= 0) {
+			auto it = std::find(free_handles_.begin(), free_handles_.end(), handle);
+			ASSERT_LOG(it != free_handles_.end(), "Unit handle " << handle << " is in use, can't give it to " << u);
+			free_handles_.erase(it);
+			handle_units_[handle] = u;
+		} else if(!free_handles_.empty()) {
+			handle = free_handles_.back();
+			free_handles_.pop_back();
+			handle_units_[handle] = u;
+		} else {
+			handle = static_cast<int>(handle_units_.size());
+			handle_units_.emplace_back(u);
+		}
+		unit_handles_[u->get_uuid()] = handle;
+		return handle;
+	}
+
+	int state::unindex_unit(const unit_ptr& u)
+	{
+		auto it = unit_handles_.find(u->get_uuid());
+		if(it == unit_handles_.end() || handle_units_[it->second] != u) {
+			return -1;
+		}
+		const int handle = it->second;
+		handle_units_[handle].reset();
+		free_handles_.emplace_back(handle);
+		unit_handles_.erase(it);
+		return handle;
 	}
 
 	void state::set_validation_fail_reason(const std::string& reason)
@@ -358,66 +676,43 @@ namespace game
 	{
 		profile::manager pman("state::validate_move");
 		// check that it is the turn of e to move/action.
-		if(units_.front() != u) {
-			set_validation_fail_reason(formatter() << u << " wasn't the current unit with initiative " << units_.front() << " was.");
+		if(schedule_.front() != u) {
+			set_validation_fail_reason(formatter() << u << " wasn't the current unit with initiative " << schedule_.front() << " was.");
 			return false;
 		}
 
 		LOG_DEBUG("Validate move: " << u);
 
-		std::set<point> enemy_locations;
-		std::set<point> zoc_locations;
-		// Create sets of enemy locations and tiles under zoc
-		auto e1_owner = u->get_owner();
-		for(auto entity : units_) {
-			auto pos = entity->get_position();
-			auto e2_owner = entity->get_owner();
-			if(e1_owner->team() != e2_owner->team()) {
-				enemy_locations.emplace(pos);
-				for(auto& p : map_->get_surrounding_positions(pos)) {
-					zoc_locations.emplace(p);
-				}
-			}
-		}
-		// remove enemy locations from zoc
-		for(auto& p : enemy_locations) {
-			auto it = zoc_locations.find(p);
-			if(it != zoc_locations.end()) {
-				zoc_locations.erase(it);
-			}
-		}
-		float cost(0);
+		// Enemies block a tile, and being next to one puts it under zone of control.
+		const team* own_team = u->get_owner()->team().get();
+		// Path costs are summed in fixed point, exactly as hex::find_available_moves() does.
+		hex::fixed_cost cost(0);
+		const point last_pp(path.rbegin()->x(), path.rbegin()->y());
 		auto p = path.begin();
-		bool last_tile_zoc = zoc_locations.find(point(p->x(), p->y())) != zoc_locations.end();
 		++p;
+		auto& g = get_graph();
 		for(; p != path.end(); ++p) {
 			point pp(p->x(), p->y());
-			auto tile = map_->get_tile_at(p->x(), p->y());
-			ASSERT_LOG(tile != nullptr, "No tile exists at point: " << pp);
-			cost += tile->get_cost();
-			//LOG_DEBUG("tile" << pp << ": " << tile->name() << " : " << tile->get_cost());
+			ASSERT_LOG(g->in_bounds(pp), "No tile exists at point: " << pp);
+			cost += g->tile_cost(pp);
 
-			auto it = enemy_locations.find(pp);
-			if(it != enemy_locations.end()) {
+			if(occupancy_.has_enemy(pp, own_team)) {
 				set_validation_fail_reason(formatter() << "Enemy unit exists in given path at " << pp);
 				return false;
 			}
 			// check that if we pass into a ZoC tile then we stop, i.e. no ZoC tiles mid-path.
-			auto zit = zoc_locations.find(pp);
-			if(zit != zoc_locations.end() && (pp.x != path.rbegin()->x() && pp.y != path.rbegin()->y())) {
+			if(pp != last_pp && zoc_.under_enemy_zoc(pp, own_team)) {
 				set_validation_fail_reason(formatter() << "ZOC tile at " << pp << " was in middle of path.");
 				return false;
 			}
 		}
-		if(u->get_move() >= cost) {
-			u->set_move(u->get_move() - cost);
-			if(u->get_move() < FLT_EPSILON) {
-				u->set_move(0);
-			}
-			u->set_position(path.rbegin()->x(), path.rbegin()->y());
+		const hex::fixed_cost move = hex::to_fixed_cost(u->get_move());
+		if(move >= cost) {
+			u->set_move(hex::from_fixed_cost(move - cost));
+			set_unit_position(u, last_pp);
 			return true;
 		}
-		set_validation_fail_reason(formatter() << "Unit didn't have enough movement left. " << u->get_move() << " : " << cost);
+		set_validation_fail_reason(formatter() << "Unit didn't have enough movement left. " << u->get_move() << " : " << hex::from_fixed_cost(cost));
 		return false;
 	}
 
@@ -444,19 +739,16 @@ namespace game
 			// Find the direct line between the two units
 			// make sure that there are no other entities in the way, unless the unit has the
 			// "strike-through" ability.
-			auto line = hex::logical::line(aggressor->get_position(), e->get_position());
-			// remove first and last elements from the line.
-			line.pop_back();
-			line.erase(line.begin());
-			for(auto& p : line) {
-				for(auto& en : units_) {
-					// XXX The commented out code allows you to attack through your own team members.
-					// It may be annoying to not allow this, in practice.
-					if(p == en->get_position() /*&& en->get_owner()->team() != aggressor->get_owner()->team()*/) {
-						LOG_INFO(aggressor << " could not attack target " << e << " unit in path " << en);
-						return false;
-					}
-				}
+			// XXX Checking for the team of the blocker would allow you to attack through your own
+			// team members. It may be annoying to not allow this, in practice.
+			unit_ptr blocker;
+			hex::line_blocked(aggressor->get_position(), e->get_position(), [&](const point& p) {
+				blocker = occupancy_.unit_at(p);
+				return blocker != nullptr;
+			});
+			if(blocker != nullptr) {
+				LOG_INFO(aggressor << " could not attack target " << e << " unit in path " << blocker);
+				return false;
 			}
 		}
 
@@ -512,7 +804,7 @@ namespace game
 					auto p = units.path().end() - 1;
 					auto start_p = point(units.path().begin()->x(), units.path().begin()->y());
 					LOG_INFO("moving " << e << " from " << start_p << " to position " << point(p->x(), p->y()));
-					e->set_position(p->x(), p->y());
+					set_unit_position(e, point(p->x(), p->y()));
 					break;
 				}
 				case Update_Unit_MessageType_ATTACK: {
@@ -540,17 +832,19 @@ namespace game
 			initiative_counter_ = up->initiative_counter();
 		}
 
-		// If we get sent a list of unit uuid's then we correct ours.
-		if(up->ordering().size() > 0) {
-			auto unit_list = units_;
-			units_.clear();
-			for(auto& order : up->ordering()) {
-				const uuid::uuid id = uuid::read(order);
-				for(auto u : unit_list) {
-					if(u->get_uuid() == id) {
-						units_.emplace_back(u);
-					}
-				}
+		// Units that have changed their place in the order.
+		for(auto& sch : up->schedule()) {
+			auto& u = get_unit_by_uuid(uuid::read(sch.uuid()));
+			u->set_initiative(sch.initiative());
+			schedule_.reschedule(get_unit_handle(u->get_uuid()), sch.sequence());
+		}
+
+		// If we get sent a complete list of unit uuid's then we correct ours. Rescheduled units
+		// go ahead of the rest, so the list is gone through backwards.
+		for(auto it = up->ordering().rbegin(); it != up->ordering().rend(); ++it) {
+			const int handle = get_unit_handle(uuid::read(*it));
+			if(handle >= 0) {
+				schedule_.reschedule(handle);
 			}
 		}
 
@@ -625,6 +919,7 @@ namespace game
 		}
 		if(stats.has_initiative()) {
 			u->set_initiative(stats.initiative());
+			schedule_.reschedule(get_unit_handle(u->get_uuid()));
 		}
 		if(stats.has_move()) {
 			u->set_move(stats.move());
@@ -664,3 +959,284 @@ namespace game
 		return it->second;
 	}
 }
+
+namespace
+{
+	// A map of grass, which can be changed to hills, and a unit type, without needing any
+	// data loaded.
+	hex::logical::map_ptr test_map(int w=8, int h=8)
+	{
+		std::vector<hex::logical::const_tile_ptr> types;
+		types.emplace_back(std::make_shared<hex::logical::tile>("grass", "Grass", 1.0f, 1.0f));
+		types.emplace_back(std::make_shared<hex::logical::tile>("hills", "Hills", 2.0f, 2.0f));
+		return std::make_shared<hex::logical::map>(w, h, types, std::vector<hex::logical::map::type_index>(w * h, 0));
+	}
+
+	creature::const_creature_ptr test_creature()
+	{
+		return std::make_shared<creature::creature>(json::parse("{\"name\": \"Test\", \"stats\": {\"health\": 10, \"attack\": 5, \"movement\": 4, \"initiative\": 5}, \"animations\": {}}"));
+	}
+
+	// Everything that make_*()/undo() should leave as it was, as a string to compare.
+	std::string describe_state(const game::state& gs, const game::unit_list& units)
+	{
+		std::stringstream ss;
+		auto& schedule = gs.get_schedule();
+		for(auto& u : units) {
+			const int h = gs.get_unit_handle(u->get_uuid());
+			ss << u << " I:" << u->get_initiative() << " T:" << u->get_attacks_this_turn() << " handle:" << h;
+			if(h >= 0) {
+				ss << " seq:" << schedule.sequence(h);
+			}
+			ss << "\n";
+		}
+		// Only the order units take their turns in, the heap they're kept in may be laid
+		// out differently.
+		std::vector<std::pair<float, int32_t>> order;
+		for(auto& u : gs.get_entities()) {
+			order.emplace_back(u->get_initiative(), schedule.sequence(gs.get_unit_handle(u->get_uuid())));
+		}
+		std::sort(order.begin(), order.end());
+		ss << "front: " << gs.get_unit_handle(gs.get_entities().front()->get_uuid()) << " order:";
+		for(auto& o : order) {
+			ss << " " << o.second;
+		}
+		ss << "\nnext:" << schedule.next_sequence() << " low:" << schedule.low_sequence() << " counter:" << gs.get_initiative_counter() << "\n";
+		auto& m = *gs.get_map();
+		for(int y = 0; y != m.height(); ++y) {
+			for(int x = 0; x != m.width(); ++x) {
+				auto& u = gs.get_unit_at(point(x, y));
+				ss << (u != nullptr ? gs.get_unit_handle(u->get_uuid()) : -1);
+				for(auto& p : units) {
+					ss << (gs.get_zone_of_control().under_enemy_zoc(point(x, y), p->get_owner()->team().get()) ? 'z' : '.');
+				}
+			}
+			ss << "\n";
+		}
+		return ss.str();
+	}
+}
+
+UNIT_TEST(state_undo_test)
+{
+	using namespace game;
+	auto cr = test_creature();
+
+	state gs;
+	gs.set_map(test_map());
+	auto pa = std::make_shared<player>(gs.create_team_instance("a"), PlayerType::NORMAL, "a");
+	auto pb = std::make_shared<player>(gs.create_team_instance("b"), PlayerType::NORMAL, "b");
+	gs.add_player(pa);
+	gs.add_player(pb);
+	unit_list units;
+	auto add = [&](const player_ptr& owner, const point& p, float initiative, int health) {
+		auto u = std::make_shared<unit>("test", cr, owner);
+		u->set_position(p);
+		u->set_initiative(initiative);
+		u->set_health(health);
+		u->set_attack(20);
+		u->set_move(4.0f);
+		gs.add_unit(u);
+		units.emplace_back(u);
+		return u;
+	};
+	auto a1 = add(pa, point(1, 1), 10.0f, 10);
+	add(pa, point(5, 5), 12.0f, 10);
+	// Same initiative as a1, so goes after it on sequence number.
+	auto b1 = add(pb, point(3, 1), 10.0f, 5);
+	add(pb, point(6, 2), 15.0f, 10);
+	CHECK_EQ(gs.get_entities().front(), a1);
+
+	const std::string before = describe_state(gs, units);
+	gs.make_move(a1, std::vector<point>{ point(1, 1), point(2, 1) });
+	CHECK_EQ(gs.get_unit_at(point(2, 1)), a1);
+	CHECK_EQ(a1->get_move(), 3.0f);
+	const std::string moved = describe_state(gs, units);
+	gs.make_attack(a1, b1);
+	CHECK(gs.find_unit(b1->get_uuid()) == nullptr, "target wasn't killed");
+	CHECK(gs.get_unit_at(point(3, 1)) == nullptr, "dead target still on the map");
+	const std::string attacked = describe_state(gs, units);
+	gs.make_end_turn();
+	CHECK_NE(gs.get_entities().front(), a1);
+	CHECK_EQ(gs.get_undo_depth(), 3);
+
+	gs.undo();
+	CHECK_EQ(describe_state(gs, units), attacked);
+	gs.undo();
+	CHECK_EQ(describe_state(gs, units), moved);
+	gs.undo();
+	CHECK_EQ(describe_state(gs, units), before);
+	CHECK_EQ(gs.get_undo_depth(), 0);
+}
+
+UNIT_TEST(state_schedule_sync_test)
+{
+	using namespace game;
+	auto cr = test_creature();
+	state server;
+	server.set_map(test_map());
+	auto pa = std::make_shared<player>(server.create_team_instance("a"), PlayerType::NORMAL, "a");
+	auto pb = std::make_shared<player>(server.create_team_instance("b"), PlayerType::NORMAL, "b");
+	server.add_player(pa);
+	server.add_player(pb);
+	// Mostly the same initiative, so the order comes down to sequence numbers.
+	for(int n = 0; n != 6; ++n) {
+		auto u = std::make_shared<unit>("test", cr, n % 2 ? pa : pb);
+		u->set_position(n, n);
+		u->set_initiative(n % 3 ? 10.0f : 12.0f);
+		server.add_unit(u);
+	}
+	state client(server);
+
+	for(int turn = 0; turn != 50; ++turn) {
+		std::unique_ptr<Update> up(server.create_update());
+		server.end_unit_turn(up.get());
+		CHECK_EQ(up->schedule_size(), 1);
+		CHECK_EQ(up->ordering_size(), 0);
+		std::string msg;
+		up->SerializeToString(&msg);
+		Update received;
+		CHECK(received.ParseFromString(msg), "couldn't parse the update");
+		client.apply(&received);
+
+		CHECK_EQ(client.get_entities().front()->get_uuid(), server.get_entities().front()->get_uuid());
+		CHECK_EQ(client.get_schedule().next_sequence(), server.get_schedule().next_sequence());
+		CHECK_EQ(client.get_schedule().low_sequence(), server.get_schedule().low_sequence());
+		for(auto& su : server.get_entities()) {
+			auto& cu = client.find_unit(su->get_uuid());
+			CHECK(cu != nullptr, "client is missing " << su);
+			CHECK_EQ(cu->get_initiative(), su->get_initiative());
+			CHECK_EQ(client.get_schedule().sequence(client.get_unit_handle(cu->get_uuid())), server.get_schedule().sequence(server.get_unit_handle(su->get_uuid())));
+		}
+	}
+}
+
+UNIT_TEST(state_reachability_cache_test)
+{
+	using namespace game;
+	auto cr = test_creature();
+	auto m = test_map(16, 16);
+	state gs;
+	gs.set_map(m);
+	auto pa = std::make_shared<player>(gs.create_team_instance("a"), PlayerType::NORMAL, "a");
+	auto pb = std::make_shared<player>(gs.create_team_instance("b"), PlayerType::NORMAL, "b");
+	gs.add_player(pa);
+	gs.add_player(pb);
+	auto u = std::make_shared<unit>("test", cr, pa);
+	u->set_position(1, 1);
+	u->set_move(3.0f);
+	gs.add_unit(u);
+	auto enemy = std::make_shared<unit>("test", cr, pb);
+	enemy->set_position(14, 14);
+	enemy->set_move(10.0f);
+	gs.add_unit(enemy);
+	auto cost_to = [](const hex::reachable_moves_ptr& r, const point& p) {
+		for(auto& mv : r->moves) {
+			if(mv.loc == p) {
+				return mv.path_cost;
+			}
+		}
+		return -1.0f;
+	};
+	auto& cache = gs.get_reachability_cache();
+
+	auto r1 = gs.get_reachable_moves(u);
+	CHECK_EQ(gs.get_reachable_moves(u), r1);
+	CHECK_EQ(cache.hits(), 1);
+	CHECK_EQ(cache.misses(), 1);
+	CHECK_EQ(cost_to(r1, point(3, 2)), 2.0f);
+
+	// Moving a unit nowhere near the searched area leaves the entry alone.
+	gs.make_move(enemy, std::vector<point>{ point(14, 14), point(14, 13) });
+	CHECK_EQ(gs.get_reachable_moves(u), r1);
+
+	// Moving one into it doesn't, but the old entry can still be used.
+	gs.make_move(enemy, std::vector<point>{ point(14, 13), point(3, 2) });
+	auto r2 = gs.get_reachable_moves(u);
+	CHECK(r2 != r1, "entry wasn't invalidated by a unit moving into range");
+	CHECK_EQ(cache.invalidations(), 1);
+	CHECK_EQ(cost_to(r1, point(3, 2)), 2.0f);
+	CHECK_EQ(cost_to(r2, point(3, 2)), -1.0f);
+
+	// So does changing the cost of a tile in it.
+	CHECK_EQ(cost_to(r2, point(1, 2)), 1.0f);
+	m->set_tile(1, 2, "hills");
+	auto r3 = gs.get_reachable_moves(u);
+	CHECK(r3 != r2, "entry wasn't invalidated by a tile edit");
+	CHECK_EQ(cost_to(r3, point(1, 2)), 2.0f);
+	CHECK_EQ(cache.misses(), 3);
+}
+
+UNIT_TEST(state_pursuit_path_test)
+{
+	using namespace game;
+	auto cr = test_creature();
+	auto m = test_map(12, 12);
+	state gs;
+	gs.set_map(m);
+	auto ta = gs.create_team_instance("a");
+	auto pa = std::make_shared<player>(ta, PlayerType::NORMAL, "a");
+	auto pb = std::make_shared<player>(gs.create_team_instance("b"), PlayerType::NORMAL, "b");
+	gs.add_player(pa);
+	gs.add_player(pb);
+	auto add = [&](const player_ptr& p, const point& pos) {
+		auto u = std::make_shared<unit>("test", cr, p);
+		u->set_position(pos.x, pos.y);
+		u->set_move(20.0f);
+		gs.add_unit(u);
+		return u;
+	};
+	auto chaser = add(pa, point(0, 5));
+	auto target = add(pb, point(11, 5));
+	// A wall with a gap at the top and two units stacked on one tile of it.
+	auto b1 = add(pb, point(5, 5));
+	auto b2 = add(pb, point(5, 5));
+	for(int y = 1; y != 12; ++y) {
+		if(y != 5) {
+			add(pb, point(5, y));
+		}
+	}
+
+	// Cost of the cheapest path found from scratch, treating every enemy but the target as
+	// impassable.
+	auto flat_cost = [&]() {
+		auto& g = gs.get_graph();
+		auto graph = std::make_shared<hex::graph_t>(g, 0, 0, g->width(), g->height());
+		for(auto& e : gs.get_entities()) {
+			if(e->get_owner()->team() != ta && e != target) {
+				graph->overlay[graph->local_index(e->get_position())] |= hex::OVERLAY_ENEMY;
+			}
+		}
+		return hex::path_cost(*g, hex::find_path(graph, chaser->get_position(), target->get_position()));
+	};
+	auto pursuit_cost = [&]() {
+		auto path = gs.find_pursuit_path(chaser, target->get_position());
+		CHECK(std::find(path.begin(), path.end(), b1->get_position()) == path.end(), "pursuit path goes through an enemy");
+		return hex::path_cost(*gs.get_graph(), path);
+	};
+	CHECK_EQ(pursuit_cost(), flat_cost());
+	// Repairs after each change below only look at part of what the first search did.
+	const int first = gs.get_pursuit_expanded(chaser);
+	auto check_repair = [&]() {
+		CHECK_EQ(pursuit_cost(), flat_cost());
+		CHECK_LT(gs.get_pursuit_expanded(chaser), first);
+	};
+
+	for(int y = 2; y != 9; ++y) {
+		m->set_tile(7, y, "hills");
+	}
+	check_repair();
+
+	// The tile stays blocked while one of the units is still on it.
+	gs.make_move(b2, std::vector<point>{ point(5, 5), point(9, 0) });
+	check_repair();
+	const hex::fixed_cost blocked = flat_cost();
+	gs.make_move(b1, std::vector<point>{ point(5, 5), point(9, 11) });
+	check_repair();
+	CHECK(flat_cost() < blocked, "moving the blocker away didn't open a shorter path");
+
+	gs.make_move(chaser, std::vector<point>{ point(0, 5), point(1, 5), point(2, 4) });
+	m->set_tile(7, 5, "grass");
+	gs.make_move(b2, std::vector<point>{ point(9, 0), point(8, 5) });
+	check_repair();
+}
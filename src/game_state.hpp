@@ -17,13 +17,17 @@
 #pragma once
 
 #include <map>
+#include <unordered_map>
 
 #include "geometry.hpp"
 #include "hex_logical_fwd.hpp"
+#include "initiative_queue.hpp"
 #include "message_format.pb.h"
+#include "occupancy.hpp"
 #include "player.hpp"
 #include "units_fwd.hpp"
 #include "uuid.hpp"
+#include "zone_of_control.hpp"
 
 namespace game
 {
@@ -37,14 +41,38 @@ namespace game
 		state(const state&);
 		~state();
 
-		const unit_list& get_entities() const { return units_; }
+		// Units in initiative order, as far as the one at the front being the one whose turn
+		// it is. The rest aren't sorted.
+		const unit_list& get_entities() const { return schedule_.units(); }
+		// The turn order, along with the sequence numbers breaking ties in initiative.
+		const initiative_queue& get_schedule() const { return schedule_; }
 
 		void set_map(hex::logical::map_ptr map);
 		const hex::logical::map_ptr& get_map() const { return map_; }
+		// Adjacency graph for the current map, shared by all path finding queries.
+		const hex::map_graph_ptr& get_graph() const;
+		// Cluster level view of the map for long range routes. Built on first use.
+		const hex::path_abstraction& get_path_abstraction() const;
 
 		void add_unit(unit_ptr e);
 		void remove_unit(unit_ptr e);
 
+		// Which unit is on each tile, kept up to date as units are added, move and die.
+		const occupancy& get_occupancy() const { return occupancy_; }
+		// Which tiles are next to units of each team, kept up to date in the same way.
+		const zone_of_control& get_zone_of_control() const { return zoc_; }
+		// Unit on p, or null if there isn't one.
+		const unit_ptr& get_unit_at(const point& p) const { return occupancy_.unit_at(p); }
+		// Units within range of p, nearest first.
+		unit_list get_units_in_range(const point& p, int range) const;
+
+		// Unit with the given id, or null.
+		const unit_ptr& find_unit(const uuid::uuid& id) const;
+		// Small integer standing for a unit while it is in the state, -1 if there is no unit
+		// with that id. Handles of removed units get reused.
+		int get_unit_handle(const uuid::uuid& id) const;
+		const unit_ptr& get_unit_by_handle(int handle) const;
+
 		float get_initiative_counter() const { return initiative_counter_; }
 
 		// Players are abstract and not entities in this case, since we need special handling.
@@ -59,6 +87,18 @@ namespace game
 
 		bool is_attackable(const unit_ptr& aggressor, const unit_ptr& e) const;
 
+		// Tiles the unit can reach with its remaining movement. Results are cached and only
+		// recomputed after something changes near the area that was searched.
+		hex::reachable_moves_ptr get_reachable_moves(const unit_ptr& u) const;
+		// Fills in the cache for all of units at once, the searches are run in parallel.
+		void prefetch_reachable_moves(const unit_list& units) const;
+		// Path from u to goal, ignoring zone of control. The search is kept between calls and 
+		// only repaired for whatever changed, as long as the goal stays the same.
+		hex::result_path find_pursuit_path(const unit_ptr& u, const point& goal) const;
+		// Vertices the last find_pursuit_path() for u had to look at.
+		int get_pursuit_expanded(const unit_ptr& u) const;
+		const hex::reachability_cache& get_reachability_cache() const { return *reachability_; }
+
 		// Client side functions
 		Update* create_update() const;
 		const state& unit_summon(Update* up, unit_ptr e) const;
@@ -69,6 +109,20 @@ namespace game
 		// Server side function.
 		void end_unit_turn(Update* up);
 
+		// Changes made in place for searching through possible plays, without copying the
+		// state. Each one records what it changed in the undo log and undo() puts back the
+		// most recent one exactly, including the turn order and initiative counter (though
+		// units after the front of get_entities() may come back in a different order). No
+		// updates are generated and nothing is checked, the moves should come from
+		// get_reachable_moves() and is_attackable().
+		void make_move(const unit_ptr& u, const std::vector<point>& path);
+		// The attack is resolved as combat() does, with critical deciding whether the strike
+		// was critical instead of it being random.
+		void make_attack(const unit_ptr& aggressor, const unit_ptr& target, bool critical=false);
+		void make_end_turn();
+		void undo();
+		int get_undo_depth() const { return static_cast<int>(undo_log_.size()); }
+
 		// Server-side function for validating the received update.
 		Update* validate_and_apply(Update* up);
 		// Client-side function for processing recived update, checking the reply
@@ -88,19 +142,74 @@ namespace game
 		float initiative_counter_;
 		mutable int update_counter_;
 		hex::logical::map_ptr map_;
-		// List of game entities with stats tag. Sorted by intiative.
-		unit_list units_;
+		mutable hex::map_graph_ptr graph_;
+		// Map revision the graph (and abstraction) were last brought up to date with.
+		mutable int map_revision_;
+		// Game entities with stats tag, ordered by intiative.
+		initiative_queue schedule_;
+		// Positions of the units, by tile. Only covers units on the map.
+		mutable occupancy occupancy_;
+		mutable zone_of_control zoc_;
+		// Handle for each unit by id, and the unit for each handle.
+		std::unordered_map<uuid::uuid, int, uuid::hash> unit_handles_;
+		unit_list handle_units_;
+		std::vector<int> free_handles_;
+
+		// What a unit was like before a change, enough to put it back.
+		struct unit_snapshot
+		{
+			int handle;
+			point pos;
+			float move;
+			float initiative;
+			int health;
+			int attacks_this_turn;
+		};
+		struct undo_entry
+		{
+			enum class Type : unsigned char {
+				MOVE,
+				ATTACK,
+				END_TURN,
+			};
+			Type type;
+			unit_snapshot unit;
+			unit_snapshot target;
+			// Only set if the target died. Its place in the turn order is kept as well.
+			unit_ptr dead_target;
+			int32_t target_sequence;
+			int32_t unit_sequence;
+			int32_t next_sequence;
+			int32_t low_sequence;
+			float initiative_counter;
+		};
+		std::vector<undo_entry> undo_log_;
 		std::map<uuid::uuid, player_ptr> players_;
 		// Used to synchronise state with the server.
 		std::string fail_reason_;
 		std::map<uuid::uuid, team_ptr> teams_;
-
-		unit_ptr get_unit_by_uuid(const uuid::uuid& id);
+		// Not part of the state proper, so each copy of the state gets its own.
+		mutable std::shared_ptr<hex::reachability_cache> reachability_;
+		mutable std::shared_ptr<hex::path_abstraction> abstraction_;
+		mutable std::shared_ptr<hex::pursuit_planners> pursuit_;
+
+		const unit_ptr& get_unit_by_uuid(const uuid::uuid& id) const;
+		// Gives u a handle, reusing the most recently freed one, or the given handle (which
+		// must be free) when putting back a unit that was removed.
+		int index_unit(const unit_ptr& u, int handle=-1);
+		int unindex_unit(const unit_ptr& u);
 		void set_validation_fail_reason(const std::string& reason);
 
 		void combat(Update* up, Update_Unit* agg_uu, unit_ptr aggressor, unit_ptr target);
 
 		void set_unit_stats(unit_ptr e, const Update_UnitStats& stats);
+		void set_unit_position(const unit_ptr& u, const point& p) const;
+		// Adds e to the occupancy and zone of control indexes and tells the caches about it.
+		void place_unit(const unit_ptr& e);
+		unit_snapshot snapshot(const unit_ptr& u) const;
+		void restore(const unit_snapshot& s);
+		void rebuild_unit_indexes();
+		void sync_map() const;
 
 		bool validate_move(const unit_ptr& u, const ::google::protobuf::RepeatedPtrField<Update_Location>& path);
 	};
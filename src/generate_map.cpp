@@ -0,0 +1,146 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+// --utility=generate-map <width> <height> <output file> [seed]
+// Makes a map from noise, an elevation and a moisture value for each tile picking the
+// terrain. The map is worked out a chunk at a time on the shared thread pool. Output files
+// ending in .cfg or .json get a JSON map, anything else gets a binary chunk file which is
+// loaded with a map node of { "chunk_file": "<output file>" }.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include <noise/noise.h>
+
+#include "asserts.hpp"
+#include "hex_logical_tiles.hpp"
+#include "json.hpp"
+#include "thread_pool.hpp"
+#include "utility.hpp"
+
+namespace
+{
+	// Tile types used, from data/hex_tiles.cfg. Indexes match the enum.
+	const char* const terrain_ids[] = { "sand", "desert", "dirt", "savanna", "grass_dry", "stone_path", "crater" };
+	enum terrain { SAND, DESERT, DIRT, SAVANNA, GRASS, STONE, CRATER, NUM_TERRAINS };
+
+	// Rough size in tiles of the hills and the wet/dry areas.
+	const double elevation_scale = 64.0;
+	const double moisture_scale = 96.0;
+
+	terrain pick_terrain(double elevation, double moisture)
+	{
+		if(elevation < -0.45) {
+			return SAND;
+		} else if(elevation > 0.65) {
+			return CRATER;
+		} else if(elevation > 0.5) {
+			return STONE;
+		} else if(moisture < -0.25) {
+			return DESERT;
+		} else if(moisture < 0.05) {
+			return DIRT;
+		} else if(moisture < 0.35) {
+			return SAVANNA;
+		}
+		return GRASS;
+	}
+
+	bool is_json_name(const std::string& fname)
+	{
+		for(auto ext : { ".cfg", ".json" }) {
+			const std::string e(ext);
+			if(fname.size() >= e.size() && fname.compare(fname.size() - e.size(), e.size(), e) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void write_json_map(const hex::logical::map& m, const std::string& fname)
+	{
+		// Streamed rather than built as a node, a node for a big map takes gigabytes.
+		std::ofstream out(fname.c_str());
+		ASSERT_LOG(out.is_open(), "Couldn't open " << fname << " for writing.");
+		out << "{\n\tzorder: 0,\n\tx: 0,\n\ty: 0,\n\twidth: " << m.width() << ",\n\ttiles: [\n";
+		for(int y = 0; y != m.height(); ++y) {
+			out << "\t  ";
+			for(int x = 0; x != m.width(); ++x) {
+				out << '"' << terrain_ids[m.tile_type(y * m.width() + x)] << "\",";
+			}
+			out << "\n";
+		}
+		out << "\t],\n}\n";
+		ASSERT_LOG(out, "Failed writing " << fname);
+	}
+
+	COMMAND_LINE_UTILITY("generate-map")
+	{
+		ASSERT_LOG(args.size() >= 3, "Usage: --utility=generate-map <width> <height> <output file> [seed]");
+		const int width = std::atoi(args[0].c_str());
+		const int height = std::atoi(args[1].c_str());
+		const std::string& out_file = args[2];
+		const int seed = args.size() > 3 ? std::atoi(args[3].c_str()) : 0;
+		ASSERT_LOG(width > 0 && height > 0, "Bad map size: " << width << "x" << height);
+
+		hex::logical::loader(json::parse_from_file("data/hex_tiles.cfg"));
+
+		auto t1 = std::chrono::steady_clock::now();
+		noise::module::Perlin elevation;
+		elevation.SetSeed(seed);
+		elevation.SetFrequency(1.0 / elevation_scale);
+		noise::module::Perlin moisture;
+		moisture.SetSeed(seed + 1);
+		moisture.SetFrequency(1.0 / moisture_scale);
+		moisture.SetOctaveCount(4);
+
+		// GetValue() doesn't change the modules, so they can be shared between the threads.
+		const int cs = hex::logical::map::chunk_size;
+		const int chunks_x = (width + cs - 1) / cs;
+		const int chunks_y = (height + cs - 1) / cs;
+		std::vector<hex::logical::map::type_index> tiles(static_cast<size_t>(width) * height);
+		threading::pool::get().parallel_for(chunks_x * chunks_y, [&](int c) {
+			const int x1 = (c % chunks_x) * cs;
+			const int y1 = (c / chunks_x) * cs;
+			for(int y = y1; y < std::min(height, y1 + cs); ++y) {
+				for(int x = x1; x < std::min(width, x1 + cs); ++x) {
+					// Odd columns sit half a tile lower.
+					const double fx = x * 0.75;
+					const double fy = y + (x & 1) * 0.5;
+					tiles[static_cast<size_t>(y) * width + x] = static_cast<hex::logical::map::type_index>(
+						pick_terrain(elevation.GetValue(fx, fy, 0.0), moisture.GetValue(fx, fy, 0.0)));
+				}
+			}
+		});
+		auto t2 = std::chrono::steady_clock::now();
+
+		hex::logical::map m(width, height, std::vector<std::string>(terrain_ids, terrain_ids + NUM_TERRAINS), tiles);
+		if(is_json_name(out_file)) {
+			write_json_map(m, out_file);
+		} else {
+			m.write_chunk_file(out_file);
+		}
+		auto t3 = std::chrono::steady_clock::now();
+
+		std::cout << "Generated " << width << "x" << height << " map in " 
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << "ms on " 
+			<< (threading::pool::get().size() + 1) << " threads, written to " << out_file << " in "
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(t3 - t2).count() << "ms" << std::endl;
+	}
+}
@@ -0,0 +1,93 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include "geometry.hpp"
+#include "hex_logical_fwd.hpp"
+
+// Neighbour offsets and coordinate conversions shared by the logical and the render maps.
+// Maps are stored in offset coordinates, cube (or axial, which is cube without y)
+// coordinates are used for distances and anything else that wants straight lines.
+
+// VS2013 doesn't do constexpr, the tables are plain constants there.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define HEX_CONSTEXPR inline
+#define HEX_CONSTEXPR_DATA const
+#else
+#define HEX_CONSTEXPR constexpr
+#define HEX_CONSTEXPR_DATA constexpr
+#endif
+
+namespace hex
+{
+	// Which columns are pushed down by half a hex. Everything in the game is ODD_Q.
+	enum column_layout { ODD_Q, EVEN_Q };
+
+	namespace tables
+	{
+		// Offsets to the neighbour in each direction, in the order of the direction enum.
+		// dy depends on whether the column is pushed down, which is the first index.
+		HEX_CONSTEXPR_DATA int dx[6] = { 0, 1, 1, 0, -1, -1 };
+		HEX_CONSTEXPR_DATA int dy[2][6] = {
+			{ -1, -1, 0, 1, 0, -1 },
+			{ -1, 0, 1, 1, 1, 0 },
+		};
+		// The same directions as cube offsets (x, y, z).
+		HEX_CONSTEXPR_DATA int cube[6][3] = {
+			{ 0, 1, -1 }, { 1, 0, -1 }, { 1, -1, 0 }, { 0, -1, 1 }, { -1, 0, 1 }, { -1, 1, 0 },
+		};
+	}
+
+	template<column_layout L>
+	HEX_CONSTEXPR int shoved(int x) { return (x & 1) ^ (L == EVEN_Q ? 1 : 0); }
+
+	template<column_layout L>
+	HEX_CONSTEXPR int neighbor_dx(direction d, int x) { return tables::dx[d]; }
+	template<column_layout L>
+	HEX_CONSTEXPR int neighbor_dy(direction d, int x) { return tables::dy[shoved<L>(x)][d]; }
+
+	template<column_layout L>
+	inline point neighbor(int x, int y, direction d) { return point(x + neighbor_dx<L>(d, x), y + neighbor_dy<L>(d, x)); }
+	inline point neighbor(const point& p, direction d) { return neighbor<ODD_Q>(p.x, p.y, d); }
+
+	HEX_CONSTEXPR direction opposite(direction d) { return static_cast<direction>((d + 3) % 6); }
+
+	struct cube
+	{
+		HEX_CONSTEXPR cube(int xx, int yy, int zz) : x(xx), y(yy), z(zz) {}
+		int x, y, z;
+	};
+
+	HEX_CONSTEXPR int hex_abs(int a) { return a < 0 ? -a : a; }
+
+	// How far z is moved from the row by column col.
+	template<column_layout L>
+	HEX_CONSTEXPR int column_shift(int col) { return (col + (L == EVEN_Q ? 1 : -1) * (col & 1)) / 2; }
+
+	template<column_layout L>
+	HEX_CONSTEXPR cube offset_to_cube(int col, int row) { return cube(col, column_shift<L>(col) - row - col, row - column_shift<L>(col)); }
+	template<column_layout L>
+	HEX_CONSTEXPR int cube_to_offset_row(const cube& c) { return c.z + column_shift<L>(c.x); }
+
+	HEX_CONSTEXPR cube axial_to_cube(int q, int r) { return cube(q, -q - r, r); }
+	HEX_CONSTEXPR cube cube_neighbor(const cube& c, direction d) { return cube(c.x + tables::cube[d][0], c.y + tables::cube[d][1], c.z + tables::cube[d][2]); }
+
+	HEX_CONSTEXPR int cube_distance(const cube& a, const cube& b)
+	{
+		return (hex_abs(a.x - b.x) + hex_abs(a.y - b.y) + hex_abs(a.z - b.z)) / 2;
+	}
+}
@@ -0,0 +1,219 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <algorithm>
+#include <random>
+
+#include "hex_distance_batch.hpp"
+#include "hex_logical_tiles.hpp"
+#include "unit_test.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HEX_DISTANCE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HEX_DISTANCE_SSE2
+#endif
+
+// In cube coordinates, with z = y - floor(x/2) for odd-q, the distance between two tiles is
+// the largest of |dx|, |dz| and |dx + dz|. floor(x/2) is an arithmetic shift.
+
+namespace hex
+{
+	namespace
+	{
+		inline int scalar_distance(int ox, int oz, int x, int y)
+		{
+			const int dx = x - ox;
+			const int dz = (y - (x >> 1)) - oz;
+			const int s = dx + dz;
+			const int adx = dx < 0 ? -dx : dx;
+			const int adz = dz < 0 ? -dz : dz;
+			const int as = s < 0 ? -s : s;
+			return std::max(adx, std::max(adz, as));
+		}
+
+#if defined(HEX_DISTANCE_AVX2)
+		const int lanes = 8;
+		inline __m256i vector_distance(__m256i ox, __m256i oz, const int* xs, const int* ys)
+		{
+			const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs));
+			const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys));
+			const __m256i dx = _mm256_sub_epi32(x, ox);
+			const __m256i dz = _mm256_sub_epi32(_mm256_sub_epi32(y, _mm256_srai_epi32(x, 1)), oz);
+			const __m256i s = _mm256_add_epi32(dx, dz);
+			return _mm256_max_epi32(_mm256_abs_epi32(dx), _mm256_max_epi32(_mm256_abs_epi32(dz), _mm256_abs_epi32(s)));
+		}
+#elif defined(HEX_DISTANCE_SSE2)
+		const int lanes = 4;
+		// SSE2 has no 32-bit abs or max, those came with SSSE3 and SSE4.1.
+		inline __m128i abs_epi32(__m128i v)
+		{
+			const __m128i sign = _mm_srai_epi32(v, 31);
+			return _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+		}
+		inline __m128i max_epi32(__m128i a, __m128i b)
+		{
+			const __m128i gt = _mm_cmpgt_epi32(a, b);
+			return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+		}
+		inline __m128i vector_distance(__m128i ox, __m128i oz, const int* xs, const int* ys)
+		{
+			const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(xs));
+			const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ys));
+			const __m128i dx = _mm_sub_epi32(x, ox);
+			const __m128i dz = _mm_sub_epi32(_mm_sub_epi32(y, _mm_srai_epi32(x, 1)), oz);
+			const __m128i s = _mm_add_epi32(dx, dz);
+			return max_epi32(abs_epi32(dx), max_epi32(abs_epi32(dz), abs_epi32(s)));
+		}
+#endif
+	}
+
+	void distances(const point& origin, const int* xs, const int* ys, int count, int* out)
+	{
+		const int ox = origin.x;
+		const int oz = origin.y - (origin.x >> 1);
+		int n = 0;
+#if defined(HEX_DISTANCE_AVX2)
+		const __m256i vox = _mm256_set1_epi32(ox);
+		const __m256i voz = _mm256_set1_epi32(oz);
+		for(; n + lanes <= count; n += lanes) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + n), vector_distance(vox, voz, xs + n, ys + n));
+		}
+#elif defined(HEX_DISTANCE_SSE2)
+		const __m128i vox = _mm_set1_epi32(ox);
+		const __m128i voz = _mm_set1_epi32(oz);
+		for(; n + lanes <= count; n += lanes) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + n), vector_distance(vox, voz, xs + n, ys + n));
+		}
+#endif
+		for(; n < count; ++n) {
+			out[n] = scalar_distance(ox, oz, xs[n], ys[n]);
+		}
+	}
+
+	void distances(const point& origin, const position_list& positions, std::vector<int>* out)
+	{
+		out->resize(positions.size());
+		if(!positions.empty()) {
+			distances(origin, &positions.x[0], &positions.y[0], positions.size(), &(*out)[0]);
+		}
+	}
+
+	void within_range(const point& origin, int range, const int* xs, const int* ys, int count, std::vector<int>* out)
+	{
+		const int ox = origin.x;
+		const int oz = origin.y - (origin.x >> 1);
+		int n = 0;
+#if defined(HEX_DISTANCE_AVX2)
+		const __m256i vox = _mm256_set1_epi32(ox);
+		const __m256i voz = _mm256_set1_epi32(oz);
+		const __m256i vrange = _mm256_set1_epi32(range);
+		for(; n + lanes <= count; n += lanes) {
+			const __m256i out_of_range = _mm256_cmpgt_epi32(vector_distance(vox, voz, xs + n, ys + n), vrange);
+			const int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(out_of_range)) & 0xff;
+			// Mostly nothing is in range, so that's the case to make quick.
+			if(mask != 0) {
+				for(int bit = 0; bit != lanes; ++bit) {
+					if(mask & (1 << bit)) {
+						out->emplace_back(n + bit);
+					}
+				}
+			}
+		}
+#elif defined(HEX_DISTANCE_SSE2)
+		const __m128i vox = _mm_set1_epi32(ox);
+		const __m128i voz = _mm_set1_epi32(oz);
+		const __m128i vrange = _mm_set1_epi32(range);
+		for(; n + lanes <= count; n += lanes) {
+			const __m128i out_of_range = _mm_cmpgt_epi32(vector_distance(vox, voz, xs + n, ys + n), vrange);
+			const int mask = ~_mm_movemask_ps(_mm_castsi128_ps(out_of_range)) & 0xf;
+			// Mostly nothing is in range, so that's the case to make quick.
+			if(mask != 0) {
+				for(int bit = 0; bit != lanes; ++bit) {
+					if(mask & (1 << bit)) {
+						out->emplace_back(n + bit);
+					}
+				}
+			}
+		}
+#endif
+		for(; n < count; ++n) {
+			if(scalar_distance(ox, oz, xs[n], ys[n]) <= range) {
+				out->emplace_back(n);
+			}
+		}
+	}
+
+	void within_range(const point& origin, int range, const position_list& positions, std::vector<int>* out)
+	{
+		if(!positions.empty()) {
+			within_range(origin, range, &positions.x[0], &positions.y[0], positions.size(), out);
+		}
+	}
+
+	int closest(const point& origin, const position_list& positions)
+	{
+		std::vector<int> d;
+		distances(origin, positions, &d);
+		int res = -1;
+		for(int n = 0; n != static_cast<int>(d.size()); ++n) {
+			if(res < 0 || d[n] < d[res]) {
+				res = n;
+			}
+		}
+		return res;
+	}
+
+	const char* distance_kernel_name()
+	{
+#if defined(HEX_DISTANCE_AVX2)
+		return "avx2";
+#elif defined(HEX_DISTANCE_SSE2)
+		return "sse2";
+#else
+		return "scalar";
+#endif
+	}
+}
+
+UNIT_TEST(hex_distance_batch_test)
+{
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> coord(-40, 40);
+	hex::position_list positions;
+	// Not a multiple of the vector width, so the scalar tail gets used too.
+	for(int n = 0; n != 101; ++n) {
+		positions.add(point(coord(rng), coord(rng)));
+	}
+	std::vector<int> d, in_range;
+	for(int t = 0; t != 20; ++t) {
+		const point origin(coord(rng), coord(rng));
+		hex::distances(origin, positions, &d);
+		CHECK_EQ(static_cast<int>(d.size()), positions.size());
+		std::vector<int> expected_in_range;
+		for(int n = 0; n != positions.size(); ++n) {
+			CHECK_EQ(d[n], hex::logical::distance(origin, positions.get(n)));
+			if(d[n] <= 25) {
+				expected_in_range.emplace_back(n);
+			}
+		}
+		in_range.clear();
+		hex::within_range(origin, 25, positions, &in_range);
+		CHECK(in_range == expected_in_range, "within_range mismatch for origin " << origin);
+	}
+}
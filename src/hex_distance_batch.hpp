@@ -0,0 +1,54 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+
+// Hex distances from one position to many at once. Positions are odd-q offset coordinates
+// held as separate x and y arrays, so they can be worked on several at a time. An AVX2
+// version is used if the compiler is targeting it, otherwise SSE2 on x86 or plain C++.
+
+namespace hex
+{
+	struct position_list
+	{
+		std::vector<int> x;
+		std::vector<int> y;
+
+		void add(const point& p) { x.emplace_back(p.x); y.emplace_back(p.y); }
+		void clear() { x.clear(); y.clear(); }
+		int size() const { return static_cast<int>(x.size()); }
+		bool empty() const { return x.empty(); }
+		point get(int n) const { return point(x[n], y[n]); }
+	};
+
+	// out[n] = distance from origin to (xs[n], ys[n]), for n in [0, count).
+	void distances(const point& origin, const int* xs, const int* ys, int count, int* out);
+	void distances(const point& origin, const position_list& positions, std::vector<int>* out);
+
+	// Appends the index of every position within range of origin to out, in order.
+	void within_range(const point& origin, int range, const int* xs, const int* ys, int count, std::vector<int>* out);
+	void within_range(const point& origin, int range, const position_list& positions, std::vector<int>* out);
+
+	// Index of the position closest to origin, the first one on ties. -1 if there are none.
+	int closest(const point& origin, const position_list& positions);
+
+	// Name of the instruction set the kernels were built for, for logging.
+	const char* distance_kernel_name();
+}
@@ -25,11 +25,10 @@
 namespace hex 
 {
 	class hex_map;
-	class hex_object;
+	struct hex_object;
 	class tile_sheet;
 	class tile_type;
 
-	typedef std::shared_ptr<hex_object> hex_object_ptr;
 	typedef std::shared_ptr<hex_map> hex_map_ptr;
 	typedef std::shared_ptr<const tile_sheet> tile_sheet_ptr;
 	typedef std::shared_ptr<tile_type> tile_type_ptr;
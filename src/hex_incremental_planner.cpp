@@ -0,0 +1,290 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <algorithm>
+#include <limits>
+
+#include "asserts.hpp"
+#include "game_state.hpp"
+#include "hex_incremental_planner.hpp"
+#include "hex_logical_tiles.hpp"
+#include "profile_timer.hpp"
+#include "units.hpp"
+
+namespace hex
+{
+	namespace
+	{
+		// Far enough below the maximum that adding a few costs to it can't overflow.
+		const fixed_cost infinity = std::numeric_limits<fixed_cost>::max() / 4;
+
+		fixed_cost add_cost(fixed_cost a, fixed_cost b)
+		{
+			return a >= infinity || b >= infinity ? infinity : std::min(a + b, infinity);
+		}
+
+		// Past this many changes between searches it's cheaper to start over.
+		const int max_pending_changes = 1024;
+	}
+
+	dstar_lite::vertex::vertex()
+		: g(infinity),
+		  rhs(infinity),
+		  key(infinity, infinity),
+		  open(false)
+	{
+	}
+
+	dstar_lite::dstar_lite(const map_graph_ptr& g, const team_ptr& team, const point& goal)
+		: graph_(g),
+		  team_(team.get()),
+		  goal_(goal),
+		  goal_index_(g->index(goal)),
+		  start_index_(-1),
+		  last_start_(-1),
+		  km_(0),
+		  min_cost_(g->min_cost()),
+		  needs_reset_(true),
+		  expanded_(0)
+	{
+		ASSERT_LOG(g->in_bounds(goal), "Goal " << goal << " isn't on the map.");
+	}
+
+	void dstar_lite::reset()
+	{
+		vertices_.clear();
+		open_.clear();
+		changed_.clear();
+		km_ = 0;
+		min_cost_ = graph_->min_cost();
+		last_start_ = start_index_;
+		auto& v = get(goal_index_);
+		v.rhs = 0;
+		v.key = calculate_key(goal_index_, v);
+		v.open = true;
+		open_.emplace(v.key, goal_index_);
+		needs_reset_ = false;
+	}
+
+	dstar_lite::vertex& dstar_lite::get(int n)
+	{
+		return vertices_[n];
+	}
+
+	fixed_cost dstar_lite::g_of(int n) const
+	{
+		auto it = vertices_.find(n);
+		return it == vertices_.end() ? infinity : it->second.g;
+	}
+
+	fixed_cost dstar_lite::heuristic(int a, int b) const
+	{
+		return logical::distance(graph_->position(a), graph_->position(b)) * min_cost_;
+	}
+
+	fixed_cost dstar_lite::edge_cost(int v, const game::occupancy& occupants) const
+	{
+		if(v != goal_index_ && occupants.has_enemy(graph_->position(v), team_)) {
+			return infinity;
+		}
+		return graph_->tile_cost(v);
+	}
+
+	dstar_lite::key_type dstar_lite::calculate_key(int n, const vertex& v) const
+	{
+		const fixed_cost m = std::min(v.g, v.rhs);
+		return key_type(add_cost(add_cost(m, heuristic(start_index_, n)), km_), m);
+	}
+
+	void dstar_lite::update_vertex(int n, const game::occupancy& occupants)
+	{
+		auto& v = get(n);
+		if(n != goal_index_) {
+			v.rhs = infinity;
+			auto nr = graph_->neighbors(n);
+			for(auto it = nr.begin(); it != nr.end(); ++it) {
+				const int s = it.index();
+				v.rhs = std::min(v.rhs, add_cost(edge_cost(s, occupants), g_of(s)));
+			}
+		}
+		if(v.open) {
+			open_.erase(std::make_pair(v.key, n));
+			v.open = false;
+		}
+		if(v.g != v.rhs) {
+			v.key = calculate_key(n, v);
+			v.open = true;
+			open_.emplace(v.key, n);
+		}
+	}
+
+	void dstar_lite::compute_shortest_path(const game::occupancy& occupants)
+	{
+		for(;;) {
+			auto& start = get(start_index_);
+			if(open_.empty() || (!(open_.begin()->first < calculate_key(start_index_, start)) && start.rhs == start.g)) {
+				break;
+			}
+			const key_type k_old = open_.begin()->first;
+			const int n = open_.begin()->second;
+			auto& v = get(n);
+			const key_type k_new = calculate_key(n, v);
+			open_.erase(open_.begin());
+			v.open = false;
+			++expanded_;
+			if(k_old < k_new) {
+				v.key = k_new;
+				v.open = true;
+				open_.emplace(v.key, n);
+			} else if(v.g > v.rhs) {
+				v.g = v.rhs;
+				auto nr = graph_->neighbors(n);
+				for(auto it = nr.begin(); it != nr.end(); ++it) {
+					update_vertex(it.index(), occupants);
+				}
+			} else {
+				v.g = infinity;
+				update_vertex(n, occupants);
+				auto nr = graph_->neighbors(n);
+				for(auto it = nr.begin(); it != nr.end(); ++it) {
+					update_vertex(it.index(), occupants);
+				}
+			}
+		}
+	}
+
+	result_path dstar_lite::find_path(const point& start, const game::occupancy& occupants)
+	{
+		//profile::manager pman("dstar_lite::find_path");
+		ASSERT_LOG(graph_->in_bounds(start), "Start " << start << " isn't on the map.");
+		expanded_ = 0;
+		start_index_ = graph_->index(start);
+		if(needs_reset_ || min_cost_ != graph_->min_cost()) {
+			// The heuristic has to stay admissible, so a cheaper tile means starting over.
+			reset();
+		} else {
+			if(last_start_ != start_index_) {
+				km_ += heuristic(last_start_, start_index_);
+				last_start_ = start_index_;
+			}
+			// A tile changing alters the cost of every edge going into it.
+			for(int n : changed_) {
+				auto nr = graph_->neighbors(n);
+				for(auto it = nr.begin(); it != nr.end(); ++it) {
+					update_vertex(it.index(), occupants);
+				}
+			}
+			changed_.clear();
+		}
+		compute_shortest_path(occupants);
+
+		result_path path;
+		if(g_of(start_index_) >= infinity) {
+			return path;
+		}
+		path.emplace_back(start);
+		for(int n = start_index_; n != goal_index_; ) {
+			int best = -1;
+			fixed_cost best_cost = infinity;
+			auto nr = graph_->neighbors(n);
+			for(auto it = nr.begin(); it != nr.end(); ++it) {
+				const int s = it.index();
+				const fixed_cost c = add_cost(edge_cost(s, occupants), g_of(s));
+				if(c < best_cost) {
+					best_cost = c;
+					best = s;
+				}
+			}
+			if(best < 0 || static_cast<int>(path.size()) > graph_->size()) {
+				LOG_WARN("dstar_lite: no way forward from " << graph_->position(n) << " to " << goal_);
+				return result_path();
+			}
+			n = best;
+			path.emplace_back(graph_->position(n));
+		}
+		return path;
+	}
+
+	void dstar_lite::tile_changed(int n)
+	{
+		if(needs_reset_) {
+			return;
+		}
+		changed_.emplace_back(n);
+		if(static_cast<int>(changed_.size()) > max_pending_changes) {
+			needs_reset_ = true;
+		}
+	}
+
+	void dstar_lite::set_graph(const map_graph_ptr& g)
+	{
+		ASSERT_LOG(g->size() == graph_->size(), "Map graph changed size, the planner needs to be recreated.");
+		graph_ = g;
+	}
+
+	pursuit_planners::pursuit_planners(const game::state& gs)
+		: graph_(gs.get_graph()),
+		  occupancy_(gs.get_occupancy())
+	{
+	}
+
+	result_path pursuit_planners::find_path(const game::unit_ptr& u, const point& goal)
+	{
+		auto& planner = planners_[u->get_uuid()];
+		if(planner == nullptr || planner->goal() != goal) {
+			planner.reset(new dstar_lite(graph_, u->get_owner()->team(), goal));
+		}
+		auto path = planner->find_path(u->get_position(), occupancy_);
+		LOG_DEBUG("dstar_lite: " << u->get_position() << " -> " << goal << " expanded " << planner->expanded() << " vertices");
+		return path;
+	}
+
+	int pursuit_planners::expanded(const game::unit_ptr& u) const
+	{
+		auto it = planners_.find(u->get_uuid());
+		return it != planners_.end() ? it->second->expanded() : 0;
+	}
+
+	void pursuit_planners::notify(int n)
+	{
+		for(auto& p : planners_) {
+			p.second->tile_changed(n);
+		}
+	}
+
+	void pursuit_planners::occupant_changed(const point& p)
+	{
+		if(graph_->in_bounds(p)) {
+			notify(graph_->index(p));
+		}
+	}
+
+	void pursuit_planners::remove(const uuid::uuid& id)
+	{
+		planners_.erase(id);
+	}
+
+	void pursuit_planners::tiles_changed(const map_graph_ptr& g, const std::vector<point>& changes)
+	{
+		graph_ = g;
+		for(auto& p : planners_) {
+			p.second->set_graph(g);
+		}
+		for(auto& p : changes) {
+			notify(g->index(p));
+		}
+	}
+}
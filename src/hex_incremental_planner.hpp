@@ -0,0 +1,115 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "geometry.hpp"
+#include "hex_pathfinding.hpp"
+#include "occupancy.hpp"
+#include "player.hpp"
+#include "units_fwd.hpp"
+#include "uuid.hpp"
+
+namespace hex
+{
+	// D* Lite (Koenig & Likhachev) search towards a fixed goal tile. The search runs backwards
+	// from the goal, so the start moving and a few tiles changing only needs the affected part
+	// of the search to be repaired instead of starting again.
+	// Tiles with units not on our team are impassable, except the goal. Zone of control is
+	// ignored, this is for long range planning.
+	class dstar_lite
+	{
+	public:
+		dstar_lite(const map_graph_ptr& g, const team_ptr& team, const point& goal);
+
+		const point& goal() const { return goal_; }
+
+		// Cheapest path from start to the goal, first element being start. Empty if the goal
+		// can't be reached.
+		result_path find_path(const point& start, const game::occupancy& occupants);
+
+		// Something about the tile with index n changed, its cost or who is standing on it.
+		void tile_changed(int n);
+		void set_graph(const map_graph_ptr& g);
+
+		// Vertices expanded by the last find_path().
+		int expanded() const { return expanded_; }
+	private:
+		typedef std::pair<fixed_cost, fixed_cost> key_type;
+		struct vertex
+		{
+			vertex();
+			fixed_cost g;
+			fixed_cost rhs;
+			key_type key;
+			bool open;
+		};
+
+		void reset();
+		vertex& get(int n);
+		fixed_cost g_of(int n) const;
+		fixed_cost heuristic(int a, int b) const;
+		fixed_cost edge_cost(int v, const game::occupancy& occupants) const;
+		key_type calculate_key(int n, const vertex& v) const;
+		void update_vertex(int n, const game::occupancy& occupants);
+		void compute_shortest_path(const game::occupancy& occupants);
+
+		map_graph_ptr graph_;
+		const team* team_;
+		point goal_;
+		int goal_index_;
+		int start_index_;
+		// Start the keys in the queue were calculated against.
+		int last_start_;
+		fixed_cost km_;
+		fixed_cost min_cost_;
+		std::unordered_map<int, vertex> vertices_;
+		std::set<std::pair<key_type, int>> open_;
+		// Tiles changed since the last find_path().
+		std::vector<int> changed_;
+		bool needs_reset_;
+		int expanded_;
+	};
+
+	// One dstar_lite per unit, fed with the unit and tile changes from game::state. Who is
+	// standing where comes from the state's occupancy index, which must outlive this.
+	class pursuit_planners
+	{
+	public:
+		explicit pursuit_planners(const game::state& gs);
+
+		result_path find_path(const game::unit_ptr& u, const point& goal);
+		// Vertices expanded by the last find_path() for u, 0 if there hasn't been one.
+		int expanded(const game::unit_ptr& u) const;
+
+		// A unit arrived on or left p.
+		void occupant_changed(const point& p);
+		void remove(const uuid::uuid& id);
+		void tiles_changed(const map_graph_ptr& g, const std::vector<point>& changes);
+	private:
+		void notify(int n);
+
+		map_graph_ptr graph_;
+		const game::occupancy& occupancy_;
+		std::map<uuid::uuid, std::unique_ptr<dstar_lite>> planners_;
+	};
+}
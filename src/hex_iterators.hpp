@@ -0,0 +1,156 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include <iterator>
+
+#include "geometry.hpp"
+#include "hex_coords.hpp"
+
+// Iterators over groups of hex positions that don't allocate, for use in loops that get run
+// for lots of tiles. All positions are in odd-q offset coordinates.
+
+namespace hex
+{
+	namespace logical
+	{
+		// Positions of the on map neighbours of a tile, in direction order. Worked out from the
+		// direction table, so there is nothing stored per tile.
+		class neighbor_iterator : public std::iterator<std::forward_iterator_tag, point>
+		{
+		public:
+			// (lx,ly) are relative to the top left of a width x height map, which is at offset.
+			neighbor_iterator(int lx, int ly, int width, int height, const point& offset, int d)
+				: lx_(lx), ly_(ly), width_(width), height_(height), offset_(offset), d_(d), nx_(0), ny_(0)
+			{
+				skip();
+			}
+			point operator*() const { return point(nx_ + offset_.x, ny_ + offset_.y); }
+			// Tile index of the neighbour.
+			int index() const { return ny_ * width_ + nx_; }
+			direction dir() const { return static_cast<direction>(d_); }
+			neighbor_iterator& operator++() { ++d_; skip(); return *this; }
+			bool operator==(const neighbor_iterator& other) const { return d_ == other.d_; }
+			bool operator!=(const neighbor_iterator& other) const { return d_ != other.d_; }
+		private:
+			void skip() {
+				for(; d_ < 6; ++d_) {
+					// Parity has to come from the real column, not the one relative to the map.
+					nx_ = lx_ + tables::dx[d_];
+					ny_ = ly_ + tables::dy[shoved<ODD_Q>(lx_ + offset_.x)][d_];
+					if(nx_ >= 0 && ny_ >= 0 && nx_ < width_ && ny_ < height_) {
+						break;
+					}
+				}
+			}
+			int lx_, ly_;
+			int width_, height_;
+			point offset_;
+			int d_;
+			int nx_, ny_;
+		};
+
+		class neighbor_range
+		{
+		public:
+			neighbor_range(int lx, int ly, int width, int height, const point& offset)
+				: begin_(lx, ly, width, height, offset, 0), end_(lx, ly, width, height, offset, 6)
+			{
+			}
+			neighbor_iterator begin() const { return begin_; }
+			neighbor_iterator end() const { return end_; }
+		private:
+			neighbor_iterator begin_;
+			neighbor_iterator end_;
+		};
+
+		// Walks the rings around a center from min_radius out to max_radius, each ring starting
+		// from its south west corner and going anti-clockwise. Positions aren't checked against
+		// any map, so may be off it.
+		class ring_iterator : public std::iterator<std::forward_iterator_tag, point>
+		{
+		public:
+			ring_iterator(const point& center, int min_radius, int max_radius)
+				: cx_(center.x),
+				  cz_(offset_to_cube<ODD_Q>(center.x, center.y).z),
+				  radius_(min_radius),
+				  max_radius_(max_radius),
+				  n_(0)
+			{
+				start_ring();
+			}
+			const point& operator*() const { return p_; }
+			const point* operator->() const { return &p_; }
+			ring_iterator& operator++() {
+				if(radius_ == 0 || n_ + 1 == 6 * radius_) {
+					++radius_;
+					start_ring();
+					return *this;
+				}
+				// Walk the sides in the order SE, NE, N, NW, SW, S.
+				const int side = (8 - n_ / radius_) % 6;
+				x_ += tables::cube[side][0];
+				z_ += tables::cube[side][2];
+				++n_;
+				update();
+				return *this;
+			}
+			bool operator==(const ring_iterator& other) const { return radius_ == other.radius_ && n_ == other.n_; }
+			bool operator!=(const ring_iterator& other) const { return !(*this == other); }
+		private:
+			void start_ring() {
+				n_ = 0;
+				if(radius_ > max_radius_) {
+					radius_ = max_radius_ + 1;
+					return;
+				}
+				// Start radius tiles to the south west.
+				x_ = cx_ + tables::cube[SOUTH_WEST][0] * radius_;
+				z_ = cz_ + tables::cube[SOUTH_WEST][2] * radius_;
+				update();
+			}
+			void update() { p_ = point(x_, cube_to_offset_row<ODD_Q>(cube(x_, -x_ - z_, z_))); }
+
+			int cx_, cz_;
+			int x_, z_;
+			int radius_;
+			int max_radius_;
+			// Position along the current ring.
+			int n_;
+			point p_;
+		};
+
+		class ring_range
+		{
+		public:
+			ring_range(const point& center, int min_radius, int max_radius)
+				: begin_(center, min_radius, max_radius), end_(center, max_radius + 1, max_radius)
+			{
+			}
+			ring_iterator begin() const { return begin_; }
+			ring_iterator end() const { return end_; }
+		private:
+			ring_iterator begin_;
+			ring_iterator end_;
+		};
+
+		// The 6*radius tiles at exactly radius from center (just center for radius 0).
+		inline ring_range ring(const point& center, int radius) { return ring_range(center, radius, radius); }
+		// Every tile within radius of center, center first, then each ring moving outwards.
+		inline ring_range spiral(const point& center, int radius) { return ring_range(center, 0, radius); }
+	}
+}
@@ -0,0 +1,105 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include "asserts.hpp"
+#include "hex_line_of_sight.hpp"
+#include "hex_logical_tiles.hpp"
+#include "unit_test.hpp"
+
+namespace hex
+{
+	namespace
+	{
+		// Longest line kept in the shared table. Unit ranges are currently 1 or 2.
+		const int default_max_range = 16;
+	}
+
+	line_table::line_table(int max_range)
+		: max_range_(max_range),
+		  side_(2 * max_range + 1)
+	{
+		ASSERT_LOG(max_range >= 0, "Bad line table range: " << max_range);
+		lines_.resize(side_ * side_);
+		cells_.resize(side_ * side_ * side_ * side_);
+		const point origin(0, 0);
+		for(int z = -max_range_; z <= max_range_; ++z) {
+			for(int x = -max_range_; x <= max_range_; ++x) {
+				const cube delta(x, -x - z, z);
+				if(cube_distance(cube(0, 0, 0), delta) > max_range_) {
+					continue;
+				}
+				const int n = slot(delta);
+				for(auto& p : line_between(origin, point(x, cube_to_offset_row<ODD_Q>(delta)))) {
+					const cube c = offset_to_cube<ODD_Q>(p.x, p.y);
+					lines_[n].emplace_back(c);
+					cells_[n * side_ * side_ + slot(c)] = true;
+				}
+			}
+		}
+	}
+
+	const std::vector<cube>& line_table::between(const cube& delta) const
+	{
+		ASSERT_LOG(cube_distance(cube(0, 0, 0), delta) <= max_range_, "Line is longer than the table: " << delta.x << "," << delta.y << "," << delta.z);
+		return lines_[slot(delta)];
+	}
+
+	bool line_table::passes_through(const cube& delta, const cube& cell) const
+	{
+		if(hex_abs(cell.x) > max_range_ || hex_abs(cell.z) > max_range_) {
+			return false;
+		}
+		return cells_[slot(delta) * side_ * side_ + slot(cell)];
+	}
+
+	const line_table& line_table::get()
+	{
+		static line_table res(default_max_range);
+		return res;
+	}
+
+	std::vector<point> line_between(const point& from, const point& to)
+	{
+		auto res = logical::line(from, to);
+		if(res.size() < 2) {
+			return std::vector<point>();
+		}
+		return std::vector<point>(res.begin() + 1, res.end() - 1);
+	}
+}
+
+UNIT_TEST(hex_line_table_test)
+{
+	const hex::line_table table(6);
+	for(auto& from : { point(0, 0), point(5, 7), point(8, 3), point(-3, -6) }) {
+		const hex::cube a = hex::offset_to_cube<hex::ODD_Q>(from.x, from.y);
+		for(auto& to : hex::logical::spiral(from, 6)) {
+			const hex::cube b = hex::offset_to_cube<hex::ODD_Q>(to.x, to.y);
+			const hex::cube delta(b.x - a.x, b.y - a.y, b.z - a.z);
+			auto expected = hex::line_between(from, to);
+			auto& offsets = table.between(delta);
+			CHECK_EQ(offsets.size(), expected.size());
+			for(int n = 0; n != static_cast<int>(expected.size()); ++n) {
+				const hex::cube c = hex::offset_to_cube<hex::ODD_Q>(expected[n].x, expected[n].y);
+				CHECK_EQ(offsets[n].x, c.x - a.x);
+				CHECK_EQ(offsets[n].z, c.z - a.z);
+				CHECK(table.passes_through(delta, hex::cube(c.x - a.x, c.y - a.y, c.z - a.z)), "missing cell " << expected[n]);
+			}
+			CHECK(!table.passes_through(delta, hex::cube(0, 0, 0)), "line includes its start");
+			CHECK(!table.passes_through(delta, delta), "line includes its end");
+		}
+	}
+}
@@ -0,0 +1,85 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "hex_coords.hpp"
+
+namespace hex
+{
+	// The tiles that hex::logical::line() passes through, worked out once for every offset
+	// up to max_range. Lines only depend on the difference between their end points, so
+	// the tables are kept relative to the start of the line, as cube offsets.
+	class line_table
+	{
+	public:
+		explicit line_table(int max_range);
+
+		int max_range() const { return max_range_; }
+
+		// Offsets of the tiles strictly between the start of a line and delta. delta must
+		// be within max_range of the start.
+		const std::vector<cube>& between(const cube& delta) const;
+		// Whether the line to delta passes through the tile at offset cell, not counting
+		// either end. delta must be within max_range, cell can be anything.
+		bool passes_through(const cube& delta, const cube& cell) const;
+
+		// Shared table, covering the longest range any unit is likely to have.
+		static const line_table& get();
+	private:
+		int slot(const cube& c) const { return (c.z + max_range_) * side_ + c.x + max_range_; }
+
+		int max_range_;
+		// Width of the square of axial offsets covered.
+		int side_;
+		std::vector<std::vector<cube>> lines_;
+		// side_*side_ bits per line, one for each cell in the square.
+		std::vector<bool> cells_;
+	};
+
+	// Tiles strictly between from and to, from hex::logical::line().
+	std::vector<point> line_between(const point& from, const point& to);
+
+	// Whether any tile strictly between from and to is occupied. occupied is called with
+	// the tile positions.
+	template<typename F>
+	bool line_blocked(const point& from, const point& to, F occupied)
+	{
+		const cube a = offset_to_cube<ODD_Q>(from.x, from.y);
+		const cube b = offset_to_cube<ODD_Q>(to.x, to.y);
+		const cube delta(b.x - a.x, b.y - a.y, b.z - a.z);
+		auto& table = line_table::get();
+		if(cube_distance(cube(0, 0, 0), delta) > table.max_range()) {
+			// Longer than the table covers.
+			for(auto& p : line_between(from, to)) {
+				if(occupied(p)) {
+					return true;
+				}
+			}
+			return false;
+		}
+		for(auto& c : table.between(delta)) {
+			const int x = a.x + c.x;
+			if(occupied(point(x, cube_to_offset_row<ODD_Q>(cube(x, a.y + c.y, a.z + c.z))))) {
+				return true;
+			}
+		}
+		return false;
+	}
+}
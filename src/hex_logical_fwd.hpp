@@ -42,8 +42,18 @@ namespace hex
 	};
 	// XXX result_list might be better served as a std::set
 	typedef std::vector<move_cost> result_list;
+	typedef std::vector<point> result_path;
 
+	class map_graph;
+	typedef std::shared_ptr<const map_graph> map_graph_ptr;
 	struct graph_t;
 	typedef std::shared_ptr<graph_t> hex_graph_ptr;
+	struct reachable_moves;
+	typedef std::shared_ptr<const reachable_moves> reachable_moves_ptr;
+	class reachability_cache;
+	class path_abstraction;
+	class pursuit_planners;
+	class map_analysis;
+	typedef std::shared_ptr<const map_analysis> map_analysis_ptr;
 
 }
@@ -14,10 +14,18 @@
 	limitations under the License.
 */
 
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <set>
 #include <tuple>
 
 #include "asserts.hpp"
 #include "hex_logical_tiles.hpp"
+#include "hex_map_analysis.hpp"
+#include "json.hpp"
+#include "node_utils.hpp"
+#include "unit_test.hpp"
 
 namespace hex 
 {
@@ -31,6 +39,10 @@ namespace hex
 				static tile_mapping_t res;
 				return res;
 			}
+
+			const char chunk_file_magic[8] = { 'H', 'X', 'C', 'H', 'U', 'N', 'K', '1' };
+			// Chunks a paged map keeps in memory if the map node doesn't say.
+			const int default_residency_budget = 1024;
 		}
 
 		void loader(const node& n)
@@ -64,7 +76,189 @@ namespace hex
 
 		map_ptr map::factory(const node& n)
 		{
-			return std::make_shared<map>(n);
+			auto res = std::make_shared<map>(n);
+			if(n.has_key("analysis")) {
+				res->analysis_ = map_analysis::read(n["analysis"].as_string(), *res);
+			}
+			return res;
+		}
+
+		chunk_store::chunk_store(int width, int height)
+			: width_(width),
+			  height_(height),
+			  chunks_x_((width + chunk_size - 1) / chunk_size),
+			  chunks_y_((height + chunk_size - 1) / chunk_size),
+			  paged_(false),
+			  chunks_(chunks_x_ * chunks_y_),
+			  data_offset_(0),
+			  type_count_(0),
+			  budget_(0),
+			  resident_(0),
+			  clock_(0)
+		{
+			for(auto& c : chunks_) {
+				c.set_tiles(std::make_shared<chunk_tiles>(chunk_size * chunk_size));
+				c.pinned = true;
+			}
+			resident_ = static_cast<int>(chunks_.size());
+		}
+
+		chunk_store::chunk_store(int width, int height, const std::string& fname, std::streamoff data_offset, int type_count, int budget)
+			: width_(width),
+			  height_(height),
+			  chunks_x_((width + chunk_size - 1) / chunk_size),
+			  chunks_y_((height + chunk_size - 1) / chunk_size),
+			  paged_(true),
+			  chunks_(chunks_x_ * chunks_y_),
+			  fname_(fname),
+			  data_offset_(data_offset),
+			  type_count_(type_count),
+			  budget_(budget),
+			  resident_(0),
+			  clock_(0)
+		{
+		}
+
+		chunk_store::chunk_store(const chunk_store& s)
+			: width_(s.width_),
+			  height_(s.height_),
+			  chunks_x_(s.chunks_x_),
+			  chunks_y_(s.chunks_y_),
+			  paged_(s.paged_),
+			  fname_(s.fname_),
+			  data_offset_(s.data_offset_),
+			  type_count_(s.type_count_),
+			  budget_(s.budget_),
+			  resident_(0),
+			  clock_(0)
+		{
+			// The chunk vectors are shared, the file is opened again if the copy needs it.
+			std::unique_lock<std::mutex> lock(s.mutex_, std::defer_lock);
+			if(paged_) {
+				lock.lock();
+			}
+			chunks_ = s.chunks_;
+			resident_ = s.resident_;
+			clock_ = s.clock_;
+		}
+
+		chunk_store::chunk& chunk_store::fault(int c) const
+		{
+			chunk& ch = chunks_[c];
+			ch.last_used = ++clock_;
+			if(ch.tiles != nullptr) {
+				return ch;
+			}
+			ASSERT_LOG(paged_, "Chunk " << c << " of a map without a chunk file isn't loaded.");
+			if(file_ == nullptr) {
+				file_.reset(new std::ifstream(fname_.c_str(), std::ios::binary));
+				ASSERT_LOG(file_->is_open(), "Unable to open map chunk file: " << fname_);
+			}
+			const std::streamoff bytes = chunk_size * chunk_size * sizeof(type_index);
+			auto tiles = std::make_shared<chunk_tiles>(chunk_size * chunk_size);
+			file_->seekg(data_offset_ + c * bytes);
+			file_->read(reinterpret_cast<char*>(&(*tiles)[0]), bytes);
+			ASSERT_LOG(*file_, "Failed to read chunk " << c << " from " << fname_);
+			for(auto t : *tiles) {
+				ASSERT_LOG(t < type_count_, "Bad tile type " << t << " in chunk " << c << " of " << fname_);
+			}
+			ch.set_tiles(tiles);
+			++resident_;
+			evict();
+			return ch;
+		}
+
+		void chunk_store::evict() const
+		{
+			while(resident_ > budget_) {
+				// A linear scan is fine, there are only a few thousand chunks on the largest maps.
+				int oldest = -1;
+				for(int c = 0; c != static_cast<int>(chunks_.size()); ++c) {
+					const chunk& ch = chunks_[c];
+					if(ch.tiles != nullptr && !ch.pinned && ch.last_used != clock_ 
+						&& (oldest < 0 || ch.last_used < chunks_[oldest].last_used)) {
+						oldest = c;
+					}
+				}
+				if(oldest < 0) {
+					break;
+				}
+				chunks_[oldest].set_tiles(nullptr);
+				--resident_;
+			}
+		}
+
+		const chunk_store::chunk_tiles& chunk_store::loaded(int c) const
+		{
+			// Unpaged stores don't keep track of use, so can be read from several threads.
+			return paged_ ? *fault(c).tiles : *chunks_[c].tiles;
+		}
+
+		chunk_store::type_index chunk_store::get_paged(int lx, int ly) const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return fault(chunk_of(lx, ly)).data[offset_in_chunk(lx, ly)];
+		}
+
+		void chunk_store::get_row(int lx, int ly, int count, type_index* out) const
+		{
+			ASSERT_LOG(lx >= 0 && ly >= 0 && count >= 0 && lx + count <= width_ && ly < height_, "Row of " << count << " tiles at " << point(lx, ly) << " isn't on the map.");
+			std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+			if(paged_) {
+				lock.lock();
+			}
+			const int end = lx + count;
+			while(lx != end) {
+				const int n = std::min(end - lx, chunk_size - lx % chunk_size);
+				const type_index* src = &loaded(chunk_of(lx, ly))[offset_in_chunk(lx, ly)];
+				std::copy(src, src + n, out);
+				out += n;
+				lx += n;
+			}
+		}
+
+		void chunk_store::set(int lx, int ly, type_index t)
+		{
+			std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+			if(paged_) {
+				lock.lock();
+			}
+			chunk& ch = fault(chunk_of(lx, ly));
+			if(ch.tiles.use_count() > 1) {
+				ch.set_tiles(std::make_shared<chunk_tiles>(*ch.tiles));
+			}
+			ch.data[offset_in_chunk(lx, ly)] = t;
+			ch.pinned = true;
+		}
+
+		void chunk_store::write_chunks(std::ostream& out) const
+		{
+			for(int c = 0; c != static_cast<int>(chunks_.size()); ++c) {
+				std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+				if(paged_) {
+					lock.lock();
+				}
+				const chunk_tiles& tiles = loaded(c);
+				out.write(reinterpret_cast<const char*>(&tiles[0]), tiles.size() * sizeof(type_index));
+			}
+		}
+
+		int chunk_store::resident_chunks() const
+		{
+			std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+			if(paged_) {
+				lock.lock();
+			}
+			return resident_;
+		}
+
+		void chunk_store::set_residency_budget(int chunks)
+		{
+			std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+			if(paged_) {
+				lock.lock();
+			}
+			budget_ = chunks;
 		}
 
 		map::map(const node& n)
@@ -73,11 +267,127 @@ namespace hex
 			  width_(n["width"].as_int32()), 
 			  height_(0)
 		{
-			tiles_.reserve(width_ * width_);	// approximation
-			for (auto& tile_str : n["tiles"].as_list_strings()) {
-				tiles_.emplace_back(tile::factory(tile_str));
+			if(n.has_key("chunk_file")) {
+				chunk_file_ = n["chunk_file"].as_string();
+				read_chunk_file_header(n["resident_chunks"].as_int32(default_residency_budget));
+				return;
+			}
+
+			auto tiles = n["tiles"].as_list_strings();
+			ASSERT_LOG(width_ > 0, "Map width must be positive: " << width_);
+			height_ = tiles.size() / width_;
+			tiles_ = std::make_shared<chunk_store>(width_, height_);
+			for(int ly = 0; ly != height_; ++ly) {
+				for(int lx = 0; lx != width_; ++lx) {
+					tiles_->set(lx, ly, get_type_index(tiles[ly * width_ + lx]));
+				}
+			}
+		}
+
+		map::map(int width, int height, const std::vector<std::string>& type_ids, const std::vector<type_index>& tiles)
+			: x_(0),
+			  y_(0),
+			  width_(width),
+			  height_(height)
+		{
+			ASSERT_LOG(width_ > 0 && height_ > 0, "Bad map size: " << width_ << "x" << height_);
+			for(auto& id : type_ids) {
+				get_type_index(id);
+			}
+			ASSERT_LOG(types_.size() == type_ids.size(), "Tile types given to the map aren't all different.");
+			fill_tiles(tiles);
+		}
+
+		map::map(int width, int height, const std::vector<const_tile_ptr>& types, const std::vector<type_index>& tiles)
+			: x_(0),
+			  y_(0),
+			  width_(width),
+			  height_(height)
+		{
+			ASSERT_LOG(width_ > 0 && height_ > 0, "Bad map size: " << width_ << "x" << height_);
+			for(auto& t : types) {
+				add_type(t);
+			}
+			fill_tiles(tiles);
+		}
+
+		void map::fill_tiles(const std::vector<type_index>& tiles)
+		{
+			ASSERT_LOG(tiles.size() == size(), "Map has " << tiles.size() << " tiles, expected " << size());
+			tiles_ = std::make_shared<chunk_store>(width_, height_);
+			for(int ly = 0; ly != height_; ++ly) {
+				for(int lx = 0; lx != width_; ++lx) {
+					const type_index t = tiles[ly * width_ + lx];
+					ASSERT_LOG(t < types_.size(), "Bad tile type " << t << " at " << point(lx, ly));
+					tiles_->set(lx, ly, t);
+				}
+			}
+		}
+
+		void map::read_chunk_file_header(int budget)
+		{
+			std::ifstream file(chunk_file_.c_str(), std::ios::binary);
+			ASSERT_LOG(file.is_open(), "Unable to open map chunk file: " << chunk_file_);
+			char magic[sizeof(chunk_file_magic)];
+			file.read(magic, sizeof(magic));
+			ASSERT_LOG(file && std::equal(magic, magic + sizeof(magic), chunk_file_magic), chunk_file_ << " isn't a map chunk file.");
+			int32_t header[4];
+			file.read(reinterpret_cast<char*>(header), sizeof(header));
+			width_ = header[0];
+			height_ = header[1];
+			ASSERT_LOG(file && width_ > 0 && height_ > 0, "Bad map size in " << chunk_file_ << ": " << width_ << "x" << height_);
+			ASSERT_LOG(header[2] == chunk_size, "Chunk size in " << chunk_file_ << " is " << header[2] << ", expected " << chunk_size);
+			for(int n = 0; n != header[3]; ++n) {
+				uint16_t len = 0;
+				file.read(reinterpret_cast<char*>(&len), sizeof(len));
+				std::string id(len, ' ');
+				file.read(&id[0], len);
+				ASSERT_LOG(file, "Couldn't read the tile types from " << chunk_file_);
+				ASSERT_LOG(get_type_index(id) == n, "Tile type " << id << " is in " << chunk_file_ << " more than once.");
 			}
-			height_ = tiles_.size() / width_;
+			tiles_ = std::make_shared<chunk_store>(width_, height_, chunk_file_, file.tellg(), static_cast<int>(types_.size()), budget);
+		}
+
+		void map::write_chunk_file(const std::string& fname) const
+		{
+			// Integers are written in the machines byte order.
+			std::ofstream out(fname.c_str(), std::ios::binary);
+			ASSERT_LOG(out.is_open(), "Unable to open " << fname << " for writing.");
+			out.write(chunk_file_magic, sizeof(chunk_file_magic));
+			const int32_t header[4] = { width_, height_, chunk_size, static_cast<int32_t>(types_.size()) };
+			out.write(reinterpret_cast<const char*>(header), sizeof(header));
+			for(auto& t : types_) {
+				const uint16_t len = static_cast<uint16_t>(t->id().size());
+				out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+				out.write(t->id().c_str(), len);
+			}
+			tiles_->write_chunks(out);
+			ASSERT_LOG(out, "Failed writing " << fname);
+		}
+
+		void map::get_row_types(int lx, int ly, int count, type_index* out) const
+		{
+			tiles_->get_row(lx, ly, count, out);
+		}
+
+		map::type_index map::get_type_index(const std::string& id)
+		{
+			// Maps only use a handful of tile types, so a linear search is fine.
+			for(int n = 0; n != static_cast<int>(types_.size()); ++n) {
+				if(types_[n]->id() == id) {
+					return static_cast<type_index>(n);
+				}
+			}
+			return add_type(tile::factory(id));
+		}
+
+		map::type_index map::add_type(const const_tile_ptr& t)
+		{
+			ASSERT_LOG(types_.size() < std::numeric_limits<type_index>::max(), "Too many different tile types on the map.");
+			types_.emplace_back(t);
+			type_costs_.emplace_back(t->get_cost());
+			type_heights_.emplace_back(t->get_height());
+			return static_cast<type_index>(types_.size() - 1);
 		}
 
 		map::map(const map& m)
@@ -85,86 +395,33 @@ namespace hex
 			  y_(m.y_),
 			  width_(m.width_),
 			  height_(m.height_),
-			  tiles_(m.tiles_)
-		{
-			// XX if we ever have a case where we need to modify tiles differently between the
-			// internal server and here then we need to clone all the elements in m.tiles_.
-		}
-
-		const_tile_ptr map::get_hex_tile(direction d, int xx, int yy) const
-		{
-			int ox = xx;
-			int oy = yy;
-			ASSERT_LOG(x() == 0 && y() == 0, "x/y values not zero (" << x() << "," << y() << ")");
-			xx -= x();
-			yy -= y();
-			if(d == NORTH) {
-				yy -= 1;
-			} else if(d == SOUTH) {
-				yy += 1;
-			} else if(d == NORTH_WEST) {
-				yy -= (abs(ox)%2==0) ? 1 : 0;
-				xx -= 1;
-			} else if(d == NORTH_EAST) {
-				yy -= (abs(ox)%2==0) ? 1 : 0;
-				xx += 1;
-			} else if(d == SOUTH_WEST) {
-				yy += (abs(ox)%2) ? 1 : 0;
-				xx -= 1;
-			} else if(d == SOUTH_EAST) {
-				yy += (abs(ox)%2) ? 1 : 0;
-				xx += 1;
-			} else {
-				ASSERT_LOG(false, "Unrecognised direction: " << d);
-			}
-			if (xx < 0 || yy < 0 || yy >= height() || xx >= width()) {
-				return nullptr;
-			}
+			  tiles_(m.tiles_),
+			  types_(m.types_),
+			  type_costs_(m.type_costs_),
+			  type_heights_(m.type_heights_),
+			  changed_tiles_(m.changed_tiles_),
+			  analysis_(m.analysis_),
+			  chunk_file_(m.chunk_file_)
+		{
+		}
 
-			const int index = yy * width() + xx;
-			ASSERT_LOG(index >= 0 && index < static_cast<int>(tiles_.size()), "Index out of bounds." << index << " >= " << tiles_.size());
-			return tiles_[index];
+		const tile* map::get_hex_tile(direction d, int xx, int yy) const
+		{
+			return get_tile_at(neighbor(point(xx, yy), d));
 		}
 
 		point map::get_coordinates_in_dir(direction d, int xx, int yy) const
 		{
-			int ox = xx;
-			int oy = yy;
-			xx -= x();
-			yy -= y();
-			switch (d) {
-				case NORTH:			yy -= 1; break;
-				case NORTH_EAST:
-					yy -= (abs(ox)%2==0) ? 1 : 0;
-					xx += 1;
-					break;
-				case SOUTH_EAST:
-					yy += (abs(ox)%2) ? 1 : 0;
-					xx += 1;
-					break;
-				case SOUTH:			yy += 1; break;
-				case SOUTH_WEST:
-					yy += (abs(ox)%2) ? 1 : 0;
-					xx -= 1;
-					break;
-				case NORTH_WEST:
-					yy -= (abs(ox)%2==0) ? 1 : 0;
-					xx -= 1;
-					break;
-				default:
-					ASSERT_LOG(false, "Unrecognised direction: " << d);
-					break;
-			}
-			return point(xx, yy) + point(x(), y());
+			return neighbor(point(xx, yy), d);
 		}
 
-		std::vector<const_tile_ptr> map::get_surrounding_tiles(int x, int y) const
+		std::vector<const tile*> map::get_surrounding_tiles(int x, int y) const
 		{
-			std::vector<const_tile_ptr> res;
-			for(auto dir : { NORTH, NORTH_EAST, SOUTH_EAST, SOUTH, SOUTH_WEST, NORTH_WEST }) {
-				auto hp = get_hex_tile(dir, x, y);
-				if(hp != nullptr) {
-					res.emplace_back(hp);
+			std::vector<const tile*> res;
+			if(in_bounds(point(x, y))) {
+				auto nr = get_neighbors(point(x, y));
+				for(auto it = nr.begin(); it != nr.end(); ++it) {
+					res.emplace_back(types_[tile_type(it.index())].get());
 				}
 			}
 			return res;
@@ -173,9 +430,8 @@ namespace hex
 		std::vector<point> map::get_surrounding_positions(int xx, int yy) const
 		{
 			std::vector<point> res;
-			for(auto dir : { NORTH, NORTH_EAST, SOUTH_EAST, SOUTH, SOUTH_WEST, NORTH_WEST }) {
-				auto p = get_coordinates_in_dir(dir, xx, yy);
-				if(p.x >= 0 && p.x >= 0 && p.x < width() && p.y < height()) {
+			if(in_bounds(point(xx, yy))) {
+				for(auto p : get_neighbors(point(xx, yy))) {
 					res.emplace_back(p);
 				}
 			}
@@ -187,24 +443,43 @@ namespace hex
 			return get_surrounding_positions(p.x, p.y);
 		}
 
-		const_tile_ptr map::get_tile_at(int xx, int yy) const
+		const tile* map::get_tile_at(int xx, int yy) const
 		{
-			xx -= x();
-			yy -= y();
-			if (xx < 0 || yy < 0 || yy >= height() || xx >= width()) {
+			const point p(xx, yy);
+			if(!in_bounds(p)) {
 				return nullptr;
 			}
-
-			const int index = yy * width() + xx;
-			ASSERT_LOG(index >= 0 && index < static_cast<int>(tiles_.size()), "");
-			return tiles_[index];
+			return types_[tile_type(index(p))].get();
 		}
 
-		const_tile_ptr map::get_tile_at(const point& p) const
+		const tile* map::get_tile_at(const point& p) const
 		{
 			return get_tile_at(p.x, p.y);
 		}
 
+		bool map::set_tile(int xx, int yy, const std::string& tile)
+		{
+			const point p(xx, yy);
+			if(!in_bounds(p)) {
+				return false;
+			}
+			const type_index t = get_type_index(tile);
+			// The store is shared with clones and graphs made from the map, they keep the old tiles.
+			if(tiles_.use_count() > 1) {
+				tiles_ = std::make_shared<chunk_store>(*tiles_);
+			}
+			tiles_->set(xx - x(), yy - y(), t);
+			changed_tiles_.emplace_back(xx, yy);
+			analysis_.reset();
+			return true;
+		}
+
+		std::vector<point> map::get_changes_since(int rev) const
+		{
+			ASSERT_LOG(rev >= 0 && rev <= revision(), "Invalid map revision: " << rev << ", current revision is " << revision());
+			return std::vector<point>(changed_tiles_.begin() + rev, changed_tiles_.end());
+		}
+
 		map_ptr map::clone()
 		{
 			return map_ptr(new map(*this));
@@ -212,24 +487,18 @@ namespace hex
 
 		std::tuple<int,int,int> oddq_to_cube_coords(const point& p)
 		{
-			int x1 = p.x;
-			int z1 = p.y - (p.x - (p.x & 1)) / 2;
-			int y1 = -(x1 + z1);
-			return std::make_tuple(x1,y1,z1);
+			const cube c = offset_to_cube<ODD_Q>(p.x, p.y);
+			return std::make_tuple(c.x, c.y, c.z);
 		}
 
 		int distance(int x1, int y1, int z1, int x2, int y2, int z2)
 		{
-			return (abs(x1 - x2) + abs(y1 - y2) + abs(z1 - z2)) / 2;
+			return cube_distance(cube(x1, y1, z1), cube(x2, y2, z2));
 		}
 
 		int distance(const point& p1, const point& p2)
 		{
-			int x1, y1, z1;
-			std::tie(x1,y1,z1) = oddq_to_cube_coords(p1);
-			int x2, y2, z2;
-			std::tie(x2,y2,z2) = oddq_to_cube_coords(p2);
-			return distance(x1, y1, z1, x2, y2, z2);
+			return cube_distance(offset_to_cube<ODD_Q>(p1.x, p1.y), offset_to_cube<ODD_Q>(p2.x, p2.y));
 		}
 
 		std::tuple<int,int,int> hex_round(float x, float y, float z) 
@@ -254,7 +523,8 @@ namespace hex
 
 		point cube_to_oddq_coords(const std::tuple<int,int,int>& xyz)
 		{
-			return point(std::get<0>(xyz), std::get<2>(xyz) + (std::get<0>(xyz) - (std::get<0>(xyz) & 1)) / 2);
+			const cube c(std::get<0>(xyz), std::get<1>(xyz), std::get<2>(xyz));
+			return point(c.x, cube_to_offset_row<ODD_Q>(c));
 		}
 
 		std::vector<point> line(const point& p1, const point& p2)
@@ -265,12 +535,20 @@ namespace hex
 			std::tie(x1,y1,z1) = oddq_to_cube_coords(p1);
 			int x2, y2, z2;
 			std::tie(x2,y2,z2) = oddq_to_cube_coords(p2);
+			if(n == 0) {
+				res.emplace_back(p1);
+				return res;
+			}
+			// Interpolate the offset from p1 rather than the absolute positions, so that the 
+			// nudges below decide ties the same way wherever the line is on the map.
 			for(int i = 0; i <= n; ++i) {
 				const float i_over_n  = static_cast<float>(i)/n;
-				const float xt = x1 * (1.0f - i_over_n) + x2 * i_over_n + 1e-6f;
-				const float yt = y1 * (1.0f - i_over_n) + y2 * i_over_n + 1e-6f;
-				const float zt = z1 * (1.0f - i_over_n) + z2 * i_over_n - 2e-6f;
-				res.emplace_back(cube_to_oddq_coords(hex_round(xt, yt, zt)));
+				const float xt = (x2 - x1) * i_over_n + 1e-6f;
+				const float yt = (y2 - y1) * i_over_n + 1e-6f;
+				const float zt = (z2 - z1) * i_over_n - 2e-6f;
+				int rx, ry, rz;
+				std::tie(rx,ry,rz) = hex_round(xt, yt, zt);
+				res.emplace_back(cube_to_oddq_coords(std::make_tuple(x1 + rx, y1 + ry, z1 + rz)));
 			}
 
 			return res;
@@ -296,3 +574,108 @@ namespace hex
 		}
 	}
 }
+
+UNIT_TEST(hex_ring_iterator_test)
+{
+	using namespace hex::logical;
+	for(auto& center : { point(0, 0), point(3, 4), point(4, 3), point(-5, 2) }) {
+		for(int r = 0; r <= 3; ++r) {
+			int count = 0;
+			for(auto& p : ring(center, r)) {
+				CHECK_EQ(distance(center, p), r);
+				++count;
+			}
+			CHECK_EQ(count, r == 0 ? 1 : 6 * r);
+
+			std::set<point> seen;
+			for(auto& p : spiral(center, r)) {
+				CHECK_LE(distance(center, p), r);
+				seen.emplace(p);
+			}
+			CHECK_EQ(static_cast<int>(seen.size()), 3 * r * (r + 1) + 1);
+		}
+	}
+}
+
+UNIT_TEST(hex_direction_table_test)
+{
+	using namespace hex;
+	for(int x = -3; x <= 3; ++x) {
+		for(int y = -3; y <= 3; ++y) {
+			const point p(x, y);
+			const cube c = offset_to_cube<ODD_Q>(x, y);
+			CHECK_EQ(c.x + c.y + c.z, 0);
+			CHECK_EQ(cube_to_offset_row<ODD_Q>(c), y);
+			const cube ce = offset_to_cube<EVEN_Q>(x, y);
+			CHECK_EQ(cube_to_offset_row<EVEN_Q>(ce), y);
+			for(int d = NORTH; d <= NORTH_WEST; ++d) {
+				const direction dir = static_cast<direction>(d);
+				const point q = neighbor(p, dir);
+				CHECK_EQ(logical::distance(p, q), 1);
+				CHECK_EQ(neighbor(q, opposite(dir)), p);
+				const cube cq = cube_neighbor(c, dir);
+				CHECK_EQ(point(cq.x, cube_to_offset_row<ODD_Q>(cq)), q);
+				const point qe = neighbor<EVEN_Q>(x, y, dir);
+				CHECK_EQ(cube_distance(ce, offset_to_cube<EVEN_Q>(qe.x, qe.y)), 1);
+			}
+		}
+	}
+}
+
+UNIT_TEST(hex_map_paging_test)
+{
+	using namespace hex::logical;
+	// Tiles are looked up by id when a chunk file is read, so they have to be loaded.
+	loader(json::parse("{\"tiles\": {\"grass\": {\"name\": \"Grass\"}, \"hills\": {\"name\": \"Hills\", \"cost\": 2}, \"water\": {\"name\": \"Water\", \"cost\": 3}}}"));
+	// Three chunks across and two down, with the last ones only partly used.
+	const int w = map::chunk_size * 2 + 5;
+	const int h = map::chunk_size + 7;
+	std::vector<map::type_index> tiles(w * h);
+	for(int n = 0; n != w * h; ++n) {
+		tiles[n] = static_cast<map::type_index>((n * 7 + n / w) % 3);
+	}
+	map m(w, h, std::vector<std::string>{ "grass", "hills", "water" }, tiles);
+	const std::string fname = "hex_map_paging_test.chunks";
+	m.write_chunk_file(fname);
+
+	const int budget = 2;
+	node_builder nb;
+	nb.add("chunk_file", fname);
+	nb.add("resident_chunks", budget);
+	auto paged = map::factory(nb.build());
+	CHECK(paged->is_paged(), "Map read from " << fname << " isn't paged");
+	CHECK_EQ(paged->width(), w);
+	CHECK_EQ(paged->height(), h);
+	// Down the columns, so every read crosses into another chunk.
+	for(int x = 0; x != w; ++x) {
+		for(int y = 0; y != h; ++y) {
+			CHECK_EQ(paged->tile_type(y * w + x), tiles[y * w + x]);
+			CHECK_LE(paged->resident_chunks(), budget);
+		}
+	}
+	std::vector<map::type_index> row(w);
+	for(int y = 0; y != h; ++y) {
+		paged->get_row_types(0, y, w, &row[0]);
+		CHECK(std::equal(row.begin(), row.end(), tiles.begin() + y * w), "Row " << y << " differs from the map that was written");
+	}
+
+	// Clones share the tiles, but don't see changes made after they were taken.
+	auto before = paged->clone();
+	const point edits[] = { point(1, 1), point(w - 1, h - 1) };
+	std::vector<std::string> ids;
+	for(auto& p : edits) {
+		ids.emplace_back(m.get_type((tiles[p.y * w + p.x] + 1) % 3).id());
+		CHECK(paged->set_tile(p.x, p.y, ids.back()), p << " not on the map");
+	}
+	// Edited chunks are never dropped, so reading everything else mustn't lose the changes.
+	for(int n = 0; n != w * h; ++n) {
+		paged->tile_type(n);
+	}
+	for(int i = 0; i != 2; ++i) {
+		CHECK_EQ(paged->get_tile_at(edits[i])->id(), ids[i]);
+		CHECK_EQ(before->get_tile_at(edits[i])->id(), m.get_tile_at(edits[i])->id());
+	}
+	// Both pinned chunks are kept, on top of the one last read.
+	CHECK_LE(paged->resident_chunks(), budget + 1);
+	std::remove(fname.c_str());
+}
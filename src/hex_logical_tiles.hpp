@@ -16,10 +16,16 @@
 
 #pragma once
 
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "geometry.hpp"
+#include "hex_coords.hpp"
+#include "hex_iterators.hpp"
 #include "hex_logical_fwd.hpp"
 #include "node.hpp"
 
@@ -49,44 +55,189 @@ namespace hex
 			float cost_;
 		};
 	
+		// The tile type indexes of a map, kept in square chunks of chunk_size tiles. Either every
+		// chunk is in memory, or chunks are read from a chunk file when first used and the
+		// least recently used ones are dropped again to keep within a budget. Chunks changed by
+		// set() stay in memory, the file is never written to.
+		// Copies share their chunks until one of them changes a chunk, so a copy kept as a
+		// snapshot costs a pointer per chunk rather than a copy of the tiles.
+		// Positions are relative to the top left of the map.
+		class chunk_store
+		{
+		public:
+			typedef uint16_t type_index;
+			static const int chunk_size = 32;
+
+			// Every chunk in memory, all the tiles being type 0.
+			chunk_store(int width, int height);
+			// Chunks are read from fname, the first starting at data_offset. The tiles in the
+			// file must all be below type_count.
+			chunk_store(int width, int height, const std::string& fname, std::streamoff data_offset, int type_count, int budget);
+			chunk_store(const chunk_store& s);
+
+			int width() const { return width_; }
+			int height() const { return height_; }
+			bool is_paged() const { return paged_; }
+
+			// Takes a lock on paged stores, so use get_row() when going through lots of tiles.
+			type_index get(int lx, int ly) const {
+				if(!paged_) {
+					return chunks_[chunk_of(lx, ly)].data[offset_in_chunk(lx, ly)];
+				}
+				return get_paged(lx, ly);
+			}
+			// Types of the count tiles starting at (lx,ly), along the row.
+			void get_row(int lx, int ly, int count, type_index* out) const;
+			void set(int lx, int ly, type_index t);
+			// Writes every chunk in order, as they are laid out in a chunk file.
+			void write_chunks(std::ostream& out) const;
+
+			int resident_chunks() const;
+			void set_residency_budget(int chunks);
+		private:
+			typedef std::vector<type_index> chunk_tiles;
+			struct chunk
+			{
+				chunk() : data(nullptr), last_used(0), pinned(false) {}
+				void set_tiles(const std::shared_ptr<chunk_tiles>& t) { tiles = t; data = t != nullptr ? &(*t)[0] : nullptr; }
+				// Null when the chunk isn't loaded, may be shared with copies of the store.
+				std::shared_ptr<chunk_tiles> tiles;
+				// Start of tiles, saves a lookup when reading.
+				type_index* data;
+				unsigned last_used;
+				bool pinned;
+			};
+
+			int chunk_of(int lx, int ly) const { return (ly / chunk_size) * chunks_x_ + lx / chunk_size; }
+			static int offset_in_chunk(int lx, int ly) { return (ly % chunk_size) * chunk_size + lx % chunk_size; }
+			type_index get_paged(int lx, int ly) const;
+			// Makes sure chunk c is loaded, the caller needs to hold mutex_ for paged stores.
+			chunk& fault(int c) const;
+			// The tiles of chunk c, with the same locking as fault().
+			const chunk_tiles& loaded(int c) const;
+			void evict() const;
+
+			int width_;
+			int height_;
+			int chunks_x_;
+			int chunks_y_;
+			bool paged_;
+			mutable std::vector<chunk> chunks_;
+
+			// Paging state, only used if paged_ is set.
+			std::string fname_;
+			std::streamoff data_offset_;
+			int type_count_;
+			int budget_;
+			mutable int resident_;
+			mutable unsigned clock_;
+			mutable std::unique_ptr<std::ifstream> file_;
+			mutable std::mutex mutex_;
+
+			void operator=(const chunk_store&);
+		};
+
+		// Tiles are stored as an index into a small table of the tile types used by the map,
+		// with the cost and height of each type kept in arrays of their own. Code that walks
+		// lots of tiles (building path finding graphs) should use tile_type()/type_costs()
+		// rather than get_tile_at().
+		// The indexes are kept in a chunk_store, which for a map node with a "chunk_file" is
+		// paged in from the file. map_graph reads its costs from the same store, and the
+		// occupancy and zone of control indexes only have entries for tiles near units, so
+		// playing on a paged map doesn't need memory for every tile. The map analysis, which
+		// is optional, does have an entry for every tile.
 		class map
 		{
 		public:
-			typedef std::vector<tile_ptr>::iterator iterator;
-			typedef std::vector<tile_ptr>::const_iterator const_iterator;
+			typedef chunk_store::type_index type_index;
+			static const int chunk_size = chunk_store::chunk_size;
 
 			explicit map(const node& n);
+			// A width x height map, tiles given row by row as indexes into type_ids.
+			map(int width, int height, const std::vector<std::string>& type_ids, const std::vector<type_index>& tiles);
+			// As above, with tile types that haven't been loaded, i.e. made up for tests.
+			map(int width, int height, const std::vector<const_tile_ptr>& types, const std::vector<type_index>& tiles);
 			map_ptr clone();
 
 			int x() const { return x_; }
 			int y() const { return y_; }
 			int width() const { return width_; }
 			int height() const { return height_; }
+			std::size_t size() const { return static_cast<std::size_t>(width_) * height_; }
 
-			// Range based for loop support.
-			iterator begin() { return tiles_.begin(); }
-			iterator end() { return tiles_.end(); }
-			const_iterator begin() const { return tiles_.begin(); }
-			const_iterator end() const { return tiles_.end(); }
-			std::size_t size() { return tiles_.size(); }
-
-			const_tile_ptr get_hex_tile(direction d, int x, int y) const;
-			std::vector<const_tile_ptr> get_surrounding_tiles(int x, int y) const;
+			const tile* get_hex_tile(direction d, int x, int y) const;
+			std::vector<const tile*> get_surrounding_tiles(int x, int y) const;
 			// Get the positions of the valid tiles surrounding the tile at (x,y)
 			std::vector<point> get_surrounding_positions(int x, int y) const;
 			std::vector<point> get_surrounding_positions(const point& p) const;
-			const_tile_ptr get_tile_at(int xx, int yy) const;
-			const_tile_ptr get_tile_at(const point& p) const;
+			// The returned pointer is owned by the map and is null if (x,y) isn't on the map.
+			const tile* get_tile_at(int xx, int yy) const;
+			const tile* get_tile_at(const point& p) const;
 			point get_coordinates_in_dir(direction d, int x, int y) const;
 
+			// Tile indexes run row by row from the top left of the map.
+			bool in_bounds(const point& p) const { return p.x >= x_ && p.y >= y_ && p.x < x_ + width_ && p.y < y_ + height_; }
+			int index(const point& p) const { return (p.y - y_) * width_ + (p.x - x_); }
+			point position(int n) const { return point(n % width_ + x_, n / width_ + y_); }
+			// The on map neighbours of the tile at p/with index n, without allocating.
+			neighbor_range get_neighbors(const point& p) const { return neighbor_range(p.x - x_, p.y - y_, width_, height_, point(x_, y_)); }
+			neighbor_range get_neighbors(int n) const { return neighbor_range(n % width_, n / width_, width_, height_, point(x_, y_)); }
+
+			// Type of the n'th tile, tiles being stored row by row. Takes a lock on paged maps,
+			// so use get_row_types() when going through lots of tiles.
+			type_index tile_type(int n) const { return tiles_->get(n % width_, n / width_); }
+			// Types of the count tiles starting at map relative (lx,ly), along the row.
+			void get_row_types(int lx, int ly, int count, type_index* out) const;
+			// The tiles as they are now. Later changes to the map don't show up in it.
+			std::shared_ptr<const chunk_store> get_tile_store() const { return tiles_; }
+			// Indexed by type_index.
+			const std::vector<float>& type_costs() const { return type_costs_; }
+			const std::vector<float>& type_heights() const { return type_heights_; }
+			const tile& get_type(type_index t) const { return *types_[t]; }
+
+			// Replace the tile at (x,y), returns false if (x,y) isn't on the map.
+			bool set_tile(int x, int y, const std::string& tile);
+			// Incremented by each set_tile(). Anything derived from the map can remember the 
+			// revision it was built from and catch up using get_changes_since().
+			int revision() const { return static_cast<int>(changed_tiles_.size()); }
+			std::vector<point> get_changes_since(int rev) const;
+
+			// Saves the map in the format read by a "chunk_file" map node.
+			void write_chunk_file(const std::string& fname) const;
+			bool is_paged() const { return !chunk_file_.empty(); }
+			const std::string& chunk_file() const { return chunk_file_; }
+			int resident_chunks() const { return tiles_->resident_chunks(); }
+			// Most chunks a paged map keeps in memory. Changed chunks are never dropped, so can take it over.
+			void set_residency_budget(int chunks) { tiles_->set_residency_budget(chunks); }
+
+			// Precomputed layout of the map, from the file named by "analysis" in the map node.
+			// nullptr if there isn't one, or the map has been changed since.
+			const map_analysis_ptr& get_analysis() const { return analysis_; }
+			void set_analysis(const map_analysis_ptr& a) { analysis_ = a; }
+
 			static map_ptr factory(const node& n);
 		private:
+			type_index get_type_index(const std::string& id);
+			type_index add_type(const const_tile_ptr& t);
+			// Makes the store then fills it with tiles given row by row.
+			void fill_tiles(const std::vector<type_index>& tiles);
+			void read_chunk_file_header(int budget);
+
 			int x_;
 			int y_;
 			int width_;
 			int height_;
 
-			std::vector<tile_ptr> tiles_;
+			// Shared with clones of the map and map_graphs made from it, until it's changed.
+			std::shared_ptr<chunk_store> tiles_;
+			std::vector<const_tile_ptr> types_;
+			std::vector<float> type_costs_;
+			std::vector<float> type_heights_;
+			// Positions passed to set_tile(), in order.
+			std::vector<point> changed_tiles_;
+			map_analysis_ptr analysis_;
+			std::string chunk_file_;
+
 			map(const map&);
 		};
 
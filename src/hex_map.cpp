@@ -16,6 +16,7 @@
 
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
 #include <sstream>
 
 #include "asserts.hpp"
@@ -29,10 +30,15 @@
 namespace hex 
 {
 	static const int HexTileSize = 72;
+	// Render chunks kept once they are off screen, around 10MB.
+	static const int RenderChunkBudget = 1024;
 
 	hex_map::hex_map(const node& value)
 		: zorder_(value["zorder"].as_int32(-1000)),
-		  border_(value["border"].as_int32(0))
+		  border_(value["border"].as_int32(0)),
+		  chunks_x_(0),
+		  chunks_y_(0),
+		  frame_(0)
 	{
 		
 		for(auto c : value["castles"].as_map()) {
@@ -45,33 +51,189 @@ namespace hex
 	{
 		hex_map_ptr p = std::make_shared<hex_map>(n);
 		p->map_ = m;
-		int index = 0;
-		p->tiles_.reserve(p->map_->size());
-		for(auto& t : *p->map_) {
-			const int x = index % p->map_->width();
-			const int y = index / p->map_->width();
-			p->tiles_.emplace_back(t->id(), x, y, p);
-			++index;
-		}
-		
-		for(auto& t : p->tiles_) {
-			t.init_neighbors();
-		}
+		const int cs = logical::map::chunk_size;
+		p->chunks_x_ = (m->width() + cs - 1) / cs;
+		p->chunks_y_ = (m->height() + cs - 1) / cs;
+		p->chunks_.resize(p->chunks_x_ * p->chunks_y_);
 		p->screen_area_ = screen_area;
 		return p;
 	}
 
+	hex_map::render_chunk& hex_map::get_chunk(int c) const
+	{
+		auto& ch = chunks_[c];
+		if(ch != nullptr) {
+			return *ch;
+		}
+		const int cs = logical::map::chunk_size;
+		ch.reset(new render_chunk);
+		ch->x = (c % chunks_x_) * cs;
+		ch->y = (c / chunks_x_) * cs;
+		ch->w = std::min(cs, map_->width() - ch->x);
+		ch->h = std::min(cs, map_->height() - ch->y);
+		ch->tiles.reserve(ch->w * ch->h);
+		std::vector<logical::map::type_index> row(ch->w);
+		for(int y = ch->y; y != ch->y + ch->h; ++y) {
+			map_->get_row_types(ch->x, y, ch->w, &row[0]);
+			for(auto t : row) {
+				ch->tiles.emplace_back(t);
+			}
+		}
+		return *ch;
+	}
+
+	hex_map::render_chunk* hex_map::get_loaded_chunk(int x, int y) const
+	{
+		if(x < 0 || y < 0 || y >= map_->height() || x >= map_->width()) {
+			return nullptr;
+		}
+		const int cs = logical::map::chunk_size;
+		return chunks_[(y / cs) * chunks_x_ + x / cs].get();
+	}
+
+	const tile_type_ptr& hex_map::get_tile_type(int type) const
+	{
+		if(type >= static_cast<int>(tile_types_.size())) {
+			tile_types_.resize(type + 1);
+		}
+		auto& res = tile_types_[type];
+		if(res == nullptr) {
+			res = tile_type::factory(map_->get_type(static_cast<logical::map::type_index>(type)).id());
+			ASSERT_LOG(res != nullptr, "Could not find tile: " << map_->get_type(static_cast<logical::map::type_index>(type)).id());
+		}
+		return res;
+	}
+
+	void hex_map::prepare_tile(render_chunk& ch, int x, int y) const
+	{
+		// Higher neighbouring types, grouped by type.
+		hex_overlay found[6];
+		int count = 0;
+		hex_object& obj = ch.tiles[(y - ch.y) * ch.w + (x - ch.x)];
+		const auto& heights = map_->type_heights();
+		for(int d = 0; d != 6; ++d) {
+			const point p = neighbor(point(x, y), static_cast<direction>(d));
+			if(p.x < 0 || p.y < 0 || p.x >= map_->width() || p.y >= map_->height()) {
+				continue;
+			}
+			// Neighbours are mostly in chunks that have already been made, which saves going
+			// to the logical map.
+			auto nch = get_loaded_chunk(p.x, p.y);
+			const uint16_t t = nch != nullptr ? nch->tiles[(p.y - nch->y) * nch->w + (p.x - nch->x)].type : map_->tile_type(p.y * map_->width() + p.x);
+			if(heights[t] <= heights[obj.type]) {
+				continue;
+			}
+			int n = 0;
+			while(n != count && found[n].type != t) {
+				++n;
+			}
+			if(n == count) {
+				found[count++] = hex_overlay(t, 0);
+			}
+			found[n].dirmap |= 1 << d;
+		}
+		for(int n = 0; n != count; ++n) {
+			get_tile_type(found[n].type)->calculate_adjacency_pattern(found[n].dirmap);
+		}
+
+		// Reuse the tile's old space in the pool if it fits.
+		ch.live_overlays += count - obj.overlay_count;
+		if(count > obj.overlay_count) {
+			obj.first_overlay = static_cast<uint32_t>(ch.overlays.size());
+			ch.overlays.resize(ch.overlays.size() + count);
+		}
+		obj.overlay_count = static_cast<uint16_t>(count);
+		std::copy(found, found + count, ch.overlays.begin() + obj.first_overlay);
+	}
+
+	void hex_map::compact_overlays(render_chunk& ch) const
+	{
+		std::vector<hex_overlay> overlays;
+		overlays.reserve(ch.live_overlays);
+		for(auto& t : ch.tiles) {
+			const uint32_t first = static_cast<uint32_t>(overlays.size());
+			overlays.insert(overlays.end(), ch.overlays.begin() + t.first_overlay, ch.overlays.begin() + t.first_overlay + t.overlay_count);
+			t.first_overlay = first;
+		}
+		ch.overlays.swap(overlays);
+	}
+
+	void hex_map::evict_chunks(int cx1, int cy1, int cx2, int cy2) const
+	{
+		int loaded = 0;
+		for(auto& ch : chunks_) {
+			if(ch != nullptr) {
+				++loaded;
+			}
+		}
+		while(loaded > RenderChunkBudget) {
+			int oldest = -1;
+			for(int c = 0; c != static_cast<int>(chunks_.size()); ++c) {
+				auto& ch = chunks_[c];
+				const int cx = c % chunks_x_;
+				const int cy = c / chunks_x_;
+				if(ch == nullptr || (cx >= cx1 && cx <= cx2 && cy >= cy1 && cy <= cy2)) {
+					continue;
+				}
+				if(oldest < 0 || ch->last_drawn < chunks_[oldest]->last_drawn) {
+					oldest = c;
+				}
+			}
+			if(oldest < 0) {
+				break;
+			}
+			chunks_[oldest].reset();
+			--loaded;
+		}
+	}
+
 	void hex_map::draw(const rect& r, const point& cam) const
 	{
-		// XXX: only draw tiles that are within the area of adjust.
-		// maybe should have a clip scope as well.
+		// XXX: maybe should have a clip scope as well.
 		rect adjust(r.x() + static_cast<int>(r.w() * screen_area_.x()),
 			r.y() + static_cast<int>(r.h() * screen_area_.y()),
 			static_cast<int>(r.w() * screen_area_.w()),
 			static_cast<int>(r.h() * screen_area_.h()));
 
-		for(auto& t : tiles_) {
-			t.draw(cam);
+		// Tiles that could touch adjust, with a tile to spare for the adjacency overlays.
+		const int HexTileSizeThreeQuarters = (HexTileSize*3)/4;
+		const int cs = logical::map::chunk_size;
+		const int x1 = std::max(0, (cam.x + adjust.x()) / HexTileSizeThreeQuarters - 2);
+		const int y1 = std::max(0, (cam.y + adjust.y()) / HexTileSize - 2);
+		const int x2 = std::min(map_->width() - 1, (cam.x + adjust.x2()) / HexTileSizeThreeQuarters + 1);
+		const int y2 = std::min(map_->height() - 1, (cam.y + adjust.y2()) / HexTileSize + 1);
+		if(x1 <= x2 && y1 <= y2) {
+			++frame_;
+			evict_chunks(x1 / cs, y1 / cs, x2 / cs, y2 / cs);
+			for(int cy = y1 / cs; cy <= y2 / cs; ++cy) {
+				for(int cx = x1 / cs; cx <= x2 / cs; ++cx) {
+					auto& ch = get_chunk(cy * chunks_x_ + cx);
+					if(!ch.prepared) {
+						for(int y = ch.y; y != ch.y + ch.h; ++y) {
+							for(int x = ch.x; x != ch.x + ch.w; ++x) {
+								prepare_tile(ch, x, y);
+							}
+						}
+						ch.prepared = true;
+					}
+					ch.last_drawn = frame_;
+					const int ty1 = std::max(y1, ch.y);
+					const int ty2 = std::min(y2, ch.y + ch.h - 1);
+					const int tx1 = std::max(x1, ch.x);
+					const int tx2 = std::min(x2, ch.x + ch.w - 1);
+					for(int y = ty1; y <= ty2; ++y) {
+						const hex_object* row = &ch.tiles[(y - ch.y) * ch.w];
+						for(int x = tx1; x <= tx2; ++x) {
+							const hex_object& t = row[x - ch.x];
+							get_tile_type(t.type)->draw(x, y, cam);
+							for(uint32_t n = t.first_overlay; n != t.first_overlay + t.overlay_count; ++n) {
+								const hex_overlay& o = ch.overlays[n];
+								get_tile_type(o.type)->draw_adjacent(x, y, cam, o.dirmap);
+							}
+						}
+					}
+				}
+			}
 		}
 		for(auto& c : castles_) {
 			c->draw(cam);
@@ -85,9 +247,9 @@ namespace hex
 		return node();
 	}
 
-	std::vector<const hex_object*> hex_map::get_surrounding_tiles(int x, int y) const
+	std::vector<tile_type_ptr> hex_map::get_surrounding_tiles(int x, int y) const
 	{
-		std::vector<const hex_object*> res;
+		std::vector<tile_type_ptr> res;
 		for(auto dir : { NORTH, NORTH_EAST, SOUTH_EAST, SOUTH, SOUTH_WEST, NORTH_WEST }) {
 			auto hp = get_hex_tile(dir, x, y);
 			if(hp != nullptr) {
@@ -97,39 +259,10 @@ namespace hex
 		return res;
 	}
 
-	const hex_object* hex_map::get_hex_tile(direction d, int x, int y) const
+	tile_type_ptr hex_map::get_hex_tile(direction d, int x, int y) const
 	{
-		int ox = x;
-		int oy = y;
-		assert(map_->x() == 0 && map_->y() == 0);
-		x -= map_->x();
-		y -= map_->y();
-		if(d == NORTH) {
-			y -= 1;
-		} else if(d == SOUTH) {
-			y += 1;
-		} else if(d == NORTH_WEST) {
-			y -= (abs(ox)%2==0) ? 1 : 0;
-			x -= 1;
-		} else if(d == NORTH_EAST) {
-			y -= (abs(ox)%2==0) ? 1 : 0;
-			x += 1;
-		} else if(d == SOUTH_WEST) {
-			y += (abs(ox)%2) ? 1 : 0;
-			x -= 1;
-		} else if(d == SOUTH_EAST) {
-			y += (abs(ox)%2) ? 1 : 0;
-			x += 1;
-		} else {
-			ASSERT_LOG(false, "Unrecognised direction: " << d);
-		}
-		if (x < 0 || y < 0 || y >= map_->height() || x >= map_->width()) {
-			return nullptr;
-		}
-
-		const int index = y * map_->width() + x;
-		assert(index >= 0 && index < static_cast<int>(tiles_.size()));
-		return &tiles_[index];
+		const point p = neighbor(point(x, y), d);
+		return get_tile_at(p.x, p.y);
 	}
 
 	point hex_map::get_tile_pos_from_pixel_pos(int mx, int my)
@@ -172,7 +305,7 @@ namespace hex
 		return point(x_base + x_modifier, y_base + y_modifier);
 	}
 
-	const hex_object* hex_map::get_tile_from_pixel_pos(int mx, int my) const
+	tile_type_ptr hex_map::get_tile_from_pixel_pos(int mx, int my) const
 	{
 		point p = get_tile_pos_from_pixel_pos(mx, my);
 		return get_tile_at(p.x, p.y);
@@ -192,59 +325,68 @@ namespace hex
 		return point(tx, ty);
 	}
 
-	const hex_object* hex_map::get_tile_at(int x, int y) const
+	tile_type_ptr hex_map::get_tile_at(int x, int y) const
 	{
 		x -= map_->x();
 		y -= map_->y();
 		if (x < 0 || y < 0 || y >= map_->height() || x >= map_->width()) {
 			return nullptr;
 		}
-
-		const int index = y * map_->width() + x;
-		assert(index >= 0 && index < static_cast<int>(tiles_.size()));
-		return &tiles_[index];
+		return get_tile_type(map_->tile_type(y * map_->width() + x));
 	}
 
 	bool hex_map::set_tile(int xx, int yy, const std::string& tile)
 	{
-		if(xx < 0 || yy < 0 || xx >= map_->width() || yy >= map_->height()) {
-			return false;
-		}
+		return set_tiles(std::vector<tile_edit>(1, tile_edit(point(xx, yy), tile))) == 1;
+	}
 
-		const int index = yy * map_->width() + xx;
-		assert(index >= 0 && index < static_cast<int>(tiles_.size()));
+	int hex_map::set_tiles(const std::vector<tile_edit>& edits)
+	{
+		// Only the edited tiles and the ones next to them can have different overlays. Tiles in
+		// chunks that haven't been made yet get worked out when they are.
+		std::vector<point> changed;
+		for(auto& e : edits) {
+			const int xx = e.pos.x;
+			const int yy = e.pos.y;
+			if(xx < 0 || yy < 0 || xx >= map_->width() || yy >= map_->height()) {
+				continue;
+			}
+			map_->set_tile(xx, yy, e.tile);
+			if(auto ch = get_loaded_chunk(xx, yy)) {
+				// The old overlays are left for prepare_tile() to reuse.
+				ch->tiles[(yy - ch->y) * ch->w + (xx - ch->x)].type = map_->tile_type(yy * map_->width() + xx);
+			}
+			changed.emplace_back(e.pos);
+			for(int d = 0; d != 6; ++d) {
+				changed.emplace_back(neighbor(e.pos, static_cast<direction>(d)));
+			}
+		}
+		const int res = static_cast<int>(changed.size() / 7);
 
-		tiles_[index] = hex_object(tile, xx, yy, shared_from_this());
-		for(auto t : tiles_) {
-			t.neighbors_changed();
+		std::sort(changed.begin(), changed.end());
+		changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+		std::vector<render_chunk*> touched;
+		for(auto& p : changed) {
+			auto ch = get_loaded_chunk(p.x, p.y);
+			if(ch != nullptr && ch->prepared) {
+				prepare_tile(*ch, p.x, p.y);
+				if(std::find(touched.begin(), touched.end(), ch) == touched.end()) {
+					touched.emplace_back(ch);
+				}
+			}
+		}
+		// Only chunks with tiles prepared again can have left overlays behind.
+		for(auto ch : touched) {
+			if(ch->overlays.size() > 2 * static_cast<size_t>(ch->live_overlays) + 64) {
+				compact_overlays(*ch);
+			}
 		}
-		return true;
+		return res;
 	}
 
 	point hex_map::loc_in_dir(int x, int y, direction d)
 	{
-		int ox = x;
-		int oy = y;
-		if(d == NORTH) {
-			y -= 1;
-		} else if(d == SOUTH) {
-			y += 1;
-		} else if(d == NORTH_WEST) {
-			y -= (abs(ox)%2==0) ? 1 : 0;
-			x -= 1;
-		} else if(d == NORTH_EAST) {
-			y -= (abs(ox)%2==0) ? 1 : 0;
-			x += 1;
-		} else if(d == SOUTH_WEST) {
-			y += (abs(ox)%2) ? 1 : 0;
-			x -= 1;
-		} else if(d == SOUTH_EAST) {
-			y += (abs(ox)%2) ? 1 : 0;
-			x += 1;
-		} else {
-			ASSERT_LOG(false, "Unrecognised direction: " << d);
-		}
-		return point(x, y);
+		return neighbor(point(x, y), d);
 	}
 
 	point hex_map::loc_in_dir(int x, int y, const std::string& s)
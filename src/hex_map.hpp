@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include "castles.hpp"
@@ -27,10 +28,14 @@
 
 namespace hex 
 {
+	// The hex_objects used for drawing are made a chunk of the logical map at a time, when
+	// something first asks for a tile in it. Tile types are shared with the logical map, each
+	// distinct type getting its tile_type when first drawn. draw() only draws chunks near the camera and drops
+	// the ones that haven't been drawn for a while once there are more than a budget.
 	class hex_map : public std::enable_shared_from_this<hex_map>
 	{
 	public:
-		hex_map() : zorder_(-1000) {}
+		hex_map() : zorder_(-1000), border_(0), chunks_x_(0), chunks_y_(0), frame_(0) {}
 		explicit hex_map(const node& n);
 		int zorder() const { return zorder_; }
 		void set_zorder(int zorder) { zorder_ = zorder; }
@@ -46,11 +51,21 @@ namespace hex
 		node write() const;
 
 		bool set_tile(int x, int y, const std::string& tile);
+		struct tile_edit
+		{
+			tile_edit(const point& p, const std::string& t) : pos(p), tile(t) {}
+			point pos;
+			std::string tile;
+		};
+		// Makes all the edits, then updates the tiles next to them once. For brush strokes and 
+		// flood fills. Returns the number of edits that were on the map.
+		int set_tiles(const std::vector<tile_edit>& edits);
 
-		std::vector<const hex_object*> get_surrounding_tiles(int x, int y) const;
-		const hex_object* get_hex_tile(direction d, int x, int y) const;
-		const hex_object* get_tile_at(int x, int y) const;
-		const hex_object* get_tile_from_pixel_pos(int x, int y) const;
+		// nullptr for positions off the map.
+		std::vector<tile_type_ptr> get_surrounding_tiles(int x, int y) const;
+		tile_type_ptr get_hex_tile(direction d, int x, int y) const;
+		tile_type_ptr get_tile_at(int x, int y) const;
+		tile_type_ptr get_tile_from_pixel_pos(int x, int y) const;
 		static point get_tile_pos_from_pixel_pos(int x, int y);
 		static point get_pixel_pos_from_tile_pos(int x, int y);
 		static point get_pixel_pos_from_tile_pos(const point& p);
@@ -68,7 +83,35 @@ namespace hex
 		int border_;
 		rectf screen_area_;
 		std::vector<castle::castle_ptr> castles_;
-		std::vector<hex_object> tiles_;
+
+		struct render_chunk
+		{
+			render_chunk() : x(0), y(0), w(0), h(0), prepared(false), last_drawn(0), live_overlays(0) {}
+			// Map relative position and size of the chunk in tiles.
+			int x, y, w, h;
+			std::vector<hex_object> tiles;
+			// Shared by the tiles, each has overlay_count entries starting at first_overlay.
+			std::vector<hex_overlay> overlays;
+			// Whether the overlays have been worked out.
+			bool prepared;
+			unsigned last_drawn;
+			// Entries of overlays still in use, the rest were left behind by edits.
+			int live_overlays;
+		};
+		render_chunk& get_chunk(int c) const;
+		// The chunk holding (x,y) if it has been made, without making it.
+		render_chunk* get_loaded_chunk(int x, int y) const;
+		void prepare_tile(render_chunk& ch, int x, int y) const;
+		void compact_overlays(render_chunk& ch) const;
+		// Drops the least recently drawn chunks outside the given chunk range while over budget.
+		void evict_chunks(int cx1, int cy1, int cx2, int cy2) const;
+		const tile_type_ptr& get_tile_type(int type) const;
+		int chunks_x_;
+		int chunks_y_;
+		mutable std::vector<std::unique_ptr<render_chunk>> chunks_;
+		// Indexed by the logical map's type indexes.
+		mutable std::vector<tile_type_ptr> tile_types_;
+		mutable unsigned frame_;
 
 		hex_map(const hex_map&);
 		void operator=(const hex_map&);
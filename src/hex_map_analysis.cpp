@@ -0,0 +1,429 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <queue>
+
+#include "asserts.hpp"
+#include "hex_logical_tiles.hpp"
+#include "hex_map_analysis.hpp"
+#include "hex_pathfinding.hpp"
+#include "profile_timer.hpp"
+#include "thread_pool.hpp"
+#include "unit_test.hpp"
+
+namespace hex
+{
+	namespace
+	{
+		const char analysis_file_magic[8] = { 'H', 'X', 'A', 'N', 'L', 'Y', 'S', '1' };
+		// Tiles needed on both sides of a cut tile for it to count as a chokepoint, so the
+		// ends of thin strips aren't all chokepoints.
+		const int min_chokepoint_split = 4;
+		// Tiles costing this many times the cheapest tile or more are rough ground.
+		const float rough_cost_factor = 1.5f;
+
+		uint32_t fnv1a(uint32_t h, uint32_t v)
+		{
+			for(int n = 0; n != 4; ++n) {
+				h = (h ^ ((v >> (n * 8)) & 0xff)) * 16777619u;
+			}
+			return h;
+		}
+
+		uint32_t file_checksum(const std::string& fname)
+		{
+			std::ifstream in(fname.c_str(), std::ios::binary);
+			ASSERT_LOG(in.is_open(), "Unable to open " << fname);
+			uint32_t res = 2166136261u;
+			std::vector<char> buf(65536);
+			while(in) {
+				in.read(&buf[0], buf.size());
+				for(std::streamsize n = 0; n != in.gcount(); ++n) {
+					res = (res ^ static_cast<unsigned char>(buf[n])) * 16777619u;
+				}
+			}
+			return res;
+		}
+
+		// Labels the groups of tiles joined through edges that joined(v, w) allows, putting
+		// the group of each tile in labels. Returns the size of each group.
+		template<typename F>
+		std::vector<int> label_groups(const map_graph& g, std::vector<int>* labels, F joined)
+		{
+			std::vector<int> sizes;
+			std::vector<int> stack;
+			labels->assign(g.size(), -1);
+			for(int s = 0; s != g.size(); ++s) {
+				if((*labels)[s] >= 0) {
+					continue;
+				}
+				const int r = static_cast<int>(sizes.size());
+				sizes.emplace_back(0);
+				(*labels)[s] = r;
+				stack.emplace_back(s);
+				while(!stack.empty()) {
+					const int v = stack.back();
+					stack.pop_back();
+					++sizes[r];
+					auto nr = g.neighbors(v);
+					for(auto it = nr.begin(); it != nr.end(); ++it) {
+						const int w = it.index();
+						if((*labels)[w] < 0 && joined(v, w)) {
+							(*labels)[w] = r;
+							stack.emplace_back(w);
+						}
+					}
+				}
+			}
+			return sizes;
+		}
+	}
+
+	uint32_t map_checksum(const logical::map& m)
+	{
+		if(m.is_paged() && m.revision() == 0) {
+			return file_checksum(m.chunk_file());
+		}
+		std::vector<uint32_t> type_hashes;
+		for(int t = 0; t != static_cast<int>(m.type_costs().size()); ++t) {
+			uint32_t h = 2166136261u;
+			for(char c : m.get_type(static_cast<logical::map::type_index>(t)).id()) {
+				h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+			}
+			type_hashes.emplace_back(h);
+		}
+		uint32_t res = fnv1a(fnv1a(2166136261u, m.width()), m.height());
+		std::vector<logical::map::type_index> row(m.width());
+		for(int y = 0; y != m.height(); ++y) {
+			m.get_row_types(0, y, m.width(), &row[0]);
+			for(auto t : row) {
+				res = fnv1a(res, type_hashes[t]);
+			}
+		}
+		return res;
+	}
+
+	map_analysis::map_analysis(const logical::map& m, int centrality_samples)
+		: x_(m.x()),
+		  y_(m.y()),
+		  width_(m.width()),
+		  height_(m.height()),
+		  checksum_(map_checksum(m))
+	{
+		profile::manager pman("map_analysis");
+		map_graph g(m);
+		tiles_.resize(g.size());
+		std::vector<bool> open(g.size());
+		for(int n = 0; n != g.size(); ++n) {
+			open[n] = g.tile_cost(n) < rough_cost_factor * g.min_cost();
+		}
+		find_regions(g);
+		find_clearance(g, open);
+		find_chokepoints(g, open);
+		find_centrality(g, centrality_samples);
+	}
+
+	void map_analysis::find_regions(const map_graph& g)
+	{
+		// Every tile can be entered, so any edge joins two tiles of the same region.
+		std::vector<int> labels;
+		region_sizes_ = label_groups(g, &labels, [](int, int) { return true; });
+		for(int n = 0; n != g.size(); ++n) {
+			tiles_[n].region = labels[n];
+		}
+	}
+
+	void map_analysis::find_chokepoints(const map_graph& g, const std::vector<bool>& open)
+	{
+		// Articulation points of each patch of open ground (Tarjan), done with an explicit
+		// stack since patches can have hundreds of thousands of tiles.
+		const int sz = g.size();
+		std::vector<int> patch;
+		const std::vector<int> patch_sizes = label_groups(g, &patch, [&open](int v, int w) { return open[v] && open[w]; });
+		// Patches that are nothing but thin strips are all cut tiles, that doesn't say much.
+		std::vector<bool> has_room(patch_sizes.size());
+		for(int n = 0; n != sz; ++n) {
+			if(open[n] && tiles_[n].clearance >= 2) {
+				has_room[patch[n]] = true;
+			}
+		}
+		std::vector<int> disc(sz, -1), low(sz), subtree(sz, 1), parent(sz, -1);
+		// Each entry is a vertex and the next of its neighbours to look at.
+		std::vector<std::pair<int,logical::neighbor_iterator>> stack;
+		int t = 0;
+		for(int s = 0; s != sz; ++s) {
+			if(disc[s] >= 0 || !open[s]) {
+				continue;
+			}
+			disc[s] = low[s] = t++;
+			stack.emplace_back(s, g.neighbors(s).begin());
+			while(!stack.empty()) {
+				const int v = stack.back().first;
+				if(stack.back().second != g.neighbors(v).end()) {
+					const int w = stack.back().second.index();
+					++stack.back().second;
+					if(patch[w] != patch[v]) {
+						continue;
+					}
+					if(disc[w] < 0) {
+						parent[w] = v;
+						disc[w] = low[w] = t++;
+						stack.emplace_back(w, g.neighbors(w).begin());
+					} else if(w != parent[v]) {
+						low[v] = std::min(low[v], disc[w]);
+					}
+					continue;
+				}
+				stack.pop_back();
+				const int p = parent[v];
+				if(p < 0) {
+					continue;
+				}
+				low[p] = std::min(low[p], low[v]);
+				subtree[p] += subtree[v];
+				// Nothing under v can get round p, so taking p away cuts off v's subtree.
+				const int rest = patch_sizes[patch[p]] - subtree[v] - 1;
+				if(low[v] >= disc[p] && subtree[v] >= min_chokepoint_split && rest >= min_chokepoint_split && has_room[patch[p]]) {
+					tiles_[p].flags |= CHOKEPOINT;
+				}
+			}
+		}
+		for(int n = 0; n != sz; ++n) {
+			if(tiles_[n].flags & CHOKEPOINT) {
+				chokepoints_.emplace_back(g.position(n));
+			}
+		}
+	}
+
+	void map_analysis::find_clearance(const map_graph& g, const std::vector<bool>& open)
+	{
+		// Breadth first out from rough ground and the edge of the map into open ground.
+		std::vector<int> queue;
+		for(int n = 0; n != g.size(); ++n) {
+			bool edge = !open[n];
+			int count = 0;
+			auto nr = g.neighbors(n);
+			for(auto it = nr.begin(); it != nr.end(); ++it, ++count) {
+				edge = edge || !open[it.index()];
+			}
+			edge = edge || count < 6;
+			if(edge) {
+				tiles_[n].clearance = 1;
+				queue.emplace_back(n);
+			}
+		}
+		for(size_t head = 0; head != queue.size(); ++head) {
+			const int v = queue[head];
+			const int c = std::min(tiles_[v].clearance + 1, 255);
+			auto nr = g.neighbors(v);
+			for(auto it = nr.begin(); it != nr.end(); ++it) {
+				const int w = it.index();
+				if(tiles_[w].clearance == 0) {
+					tiles_[w].clearance = static_cast<uint8_t>(c);
+					queue.emplace_back(w);
+				}
+			}
+		}
+	}
+
+	void map_analysis::find_centrality(const map_graph& g, int samples)
+	{
+		// Sources are spread over a grid. Each one gets a tree of cheapest paths to every
+		// tile and a tile scores the number of tiles below it in the tree.
+		if(g.size() == 0) {
+			return;
+		}
+		const int side = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(samples))));
+		std::vector<uint64_t> totals(g.size());
+		std::mutex totals_mutex;
+		threading::pool::get().parallel_for(side * side, [&](int s) {
+			const int sx = std::min(width_ - 1, (2 * (s % side) + 1) * width_ / (2 * side));
+			const int sy = std::min(height_ - 1, (2 * (s / side) + 1) * height_ / (2 * side));
+			const int src = sy * width_ + sx;
+
+			typedef std::pair<fixed_cost, int> entry;
+			std::priority_queue<entry, std::vector<entry>, std::greater<entry>> open;
+			std::vector<fixed_cost> dist(g.size(), -1);
+			std::vector<int> pred(g.size(), -1);
+			std::vector<int> order;
+			order.reserve(g.size());
+			std::vector<bool> done(g.size());
+			dist[src] = 0;
+			open.emplace(0, src);
+			while(!open.empty()) {
+				const entry top = open.top();
+				open.pop();
+				const int v = top.second;
+				if(done[v]) {
+					continue;
+				}
+				done[v] = true;
+				order.emplace_back(v);
+				auto nr = g.neighbors(v);
+				for(auto it = nr.begin(); it != nr.end(); ++it) {
+					const int w = it.index();
+					const fixed_cost d = top.first + g.tile_cost(w);
+					if(!done[w] && (dist[w] < 0 || d < dist[w])) {
+						dist[w] = d;
+						pred[w] = v;
+						open.emplace(d, w);
+					}
+				}
+			}
+			std::vector<uint32_t> below(g.size());
+			for(auto it = order.rbegin(); it != order.rend(); ++it) {
+				if(pred[*it] >= 0) {
+					below[pred[*it]] += below[*it] + 1;
+				}
+			}
+			std::lock_guard<std::mutex> lock(totals_mutex);
+			for(int n = 0; n != g.size(); ++n) {
+				totals[n] += below[n];
+			}
+		});
+		const uint64_t most = std::max<uint64_t>(1, *std::max_element(totals.begin(), totals.end()));
+		for(int n = 0; n != g.size(); ++n) {
+			tiles_[n].centrality = static_cast<uint16_t>(totals[n] * 65535 / most);
+		}
+	}
+
+	void map_analysis::write(const std::string& fname) const
+	{
+		// Integers are written in the machines byte order.
+		std::ofstream out(fname.c_str(), std::ios::binary);
+		ASSERT_LOG(out.is_open(), "Unable to open " << fname << " for writing.");
+		out.write(analysis_file_magic, sizeof(analysis_file_magic));
+		const int32_t header[5] = { x_, y_, width_, height_, static_cast<int32_t>(region_sizes_.size()) };
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(&checksum_), sizeof(checksum_));
+		if(!region_sizes_.empty()) {
+			out.write(reinterpret_cast<const char*>(&region_sizes_[0]), region_sizes_.size() * sizeof(int32_t));
+		}
+		if(!tiles_.empty()) {
+			out.write(reinterpret_cast<const char*>(&tiles_[0]), tiles_.size() * sizeof(tile_info));
+		}
+		ASSERT_LOG(out, "Failed writing " << fname);
+	}
+
+	map_analysis_ptr map_analysis::read(const std::string& fname, const logical::map& m)
+	{
+		std::ifstream in(fname.c_str(), std::ios::binary);
+		ASSERT_LOG(in.is_open(), "Unable to open map analysis file: " << fname);
+		char magic[sizeof(analysis_file_magic)];
+		in.read(magic, sizeof(magic));
+		ASSERT_LOG(in && std::equal(magic, magic + sizeof(magic), analysis_file_magic), fname << " isn't a map analysis file.");
+
+		std::shared_ptr<map_analysis> res(new map_analysis);
+		int32_t header[5];
+		in.read(reinterpret_cast<char*>(header), sizeof(header));
+		in.read(reinterpret_cast<char*>(&res->checksum_), sizeof(res->checksum_));
+		ASSERT_LOG(in, "Couldn't read the header of " << fname);
+		res->x_ = header[0];
+		res->y_ = header[1];
+		res->width_ = header[2];
+		res->height_ = header[3];
+		if(res->x_ != m.x() || res->y_ != m.y() || res->width_ != m.width() || res->height_ != m.height()) {
+			LOG_WARN(fname << " is for a different sized map, not using it.");
+			return nullptr;
+		}
+		if(res->checksum_ != map_checksum(m)) {
+			LOG_WARN(fname << " doesn't match the tiles on the map, run --utility=analyze-map again.");
+			return nullptr;
+		}
+		ASSERT_LOG(header[4] >= 0 && header[4] <= static_cast<int32_t>(m.size()), "Bad region count in " << fname << ": " << header[4]);
+		res->region_sizes_.resize(header[4]);
+		res->tiles_.resize(m.size());
+		if(!res->region_sizes_.empty()) {
+			in.read(reinterpret_cast<char*>(&res->region_sizes_[0]), res->region_sizes_.size() * sizeof(int32_t));
+		}
+		if(!res->tiles_.empty()) {
+			in.read(reinterpret_cast<char*>(&res->tiles_[0]), res->tiles_.size() * sizeof(tile_info));
+		}
+		ASSERT_LOG(in, "Couldn't read the tiles from " << fname);
+		for(int n = 0; n != static_cast<int>(res->tiles_.size()); ++n) {
+			const tile_info& t = res->tiles_[n];
+			ASSERT_LOG(t.region >= 0 && t.region < header[4], "Bad region " << t.region << " in " << fname);
+			if(t.flags & CHOKEPOINT) {
+				res->chokepoints_.emplace_back(n % res->width_ + res->x_, n / res->width_ + res->y_);
+			}
+		}
+		return res;
+	}
+}
+
+namespace
+{
+	// Grass with a wall of hills down column 6, except for a gap at (6,4).
+	hex::logical::map_ptr walled_map()
+	{
+		std::vector<hex::logical::const_tile_ptr> types;
+		types.emplace_back(std::make_shared<hex::logical::tile>("grass", "Grass", 1.0f, 1.0f));
+		types.emplace_back(std::make_shared<hex::logical::tile>("hills", "Hills", 2.0f, 2.0f));
+		std::vector<hex::logical::map::type_index> tiles(12 * 9, 0);
+		for(int y = 0; y != 9; ++y) {
+			tiles[y * 12 + 6] = y == 4 ? 0 : 1;
+		}
+		return std::make_shared<hex::logical::map>(12, 9, types, tiles);
+	}
+}
+
+UNIT_TEST(map_analysis_chokepoint_test)
+{
+	auto m = walled_map();
+	hex::map_analysis a(*m, 4);
+	// The hills slow units down but don't stop them.
+	CHECK_EQ(a.region_count(), 1);
+	CHECK_EQ(a.chokepoints().size(), 1);
+	CHECK(a.is_chokepoint(point(6, 4)), "gap in the wall isn't a chokepoint");
+	CHECK_EQ(a.clearance(point(0, 4)), 1);
+	CHECK_EQ(a.clearance(point(6, 0)), 1);
+	CHECK_EQ(a.clearance(point(2, 4)), 3);
+
+	// Filling the gap leaves two patches of open ground and nothing between them.
+	m->set_tile(6, 4, "hills");
+	hex::map_analysis b(*m, 4);
+	CHECK_EQ(b.region_count(), 1);
+	CHECK(b.chokepoints().empty(), "chokepoints found with the gap filled");
+}
+
+UNIT_TEST(map_analysis_file_test)
+{
+	const std::string fname = "map_analysis_test.analysis";
+	auto m = walled_map();
+	hex::map_analysis a(*m, 4);
+	a.write(fname);
+	auto b = hex::map_analysis::read(fname, *m);
+	CHECK(b != nullptr, "couldn't read back the analysis");
+	CHECK_EQ(b->region_count(), a.region_count());
+	CHECK(b->chokepoints() == a.chokepoints(), "chokepoints changed by writing and reading");
+	for(int n = 0; n != static_cast<int>(m->size()); ++n) {
+		const point p = m->position(n);
+		CHECK_EQ(b->region(p), a.region(p));
+		CHECK_EQ(b->clearance(p), a.clearance(p));
+		CHECK_EQ(b->centrality(p), a.centrality(p));
+	}
+
+	// A file made before the map was edited isn't used.
+	m->set_tile(0, 0, "hills");
+	CHECK(hex::map_analysis::read(fname, *m) == nullptr, "stale analysis was used");
+	std::remove(fname.c_str());
+}
@@ -0,0 +1,94 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "geometry.hpp"
+#include "hex_logical_fwd.hpp"
+
+namespace hex
+{
+	// Facts about the layout of a map that don't change during a game, worked out ahead of
+	// time by --utility=analyze-map and saved next to the map. A map node with an "analysis"
+	// entry naming the file gets it loaded with it, see logical::map::get_analysis().
+	//
+	// Regions are groups of tiles a unit can walk between, so every tile of a map where all
+	// the tiles are connected is in the one region. Open ground is tiles costing less than
+	// one and a half times the cheapest tile on the map, the rest is rough. A chokepoint is an open tile
+	// that splits its patch of open ground in two if it is taken away, with a reasonable
+	// number of tiles on each side, i.e. a pass through rough ground. Patches that are only
+	// ever one tile wide don't have any. Clearance is 1 for rough tiles and open tiles on the
+	// edge of the map or next to rough ground, and one more for each step further into open
+	// ground. Centrality is how many cheapest paths between a sample of tiles go through a
+	// tile, scaled so the busiest tile is 1.
+	class map_analysis
+	{
+	public:
+		// Does the analysis, this takes a few seconds on big maps.
+		explicit map_analysis(const logical::map& m, int centrality_samples=64);
+
+		// Returns nullptr, with a warning, if fname wasn't made from the same map.
+		static map_analysis_ptr read(const std::string& fname, const logical::map& m);
+		void write(const std::string& fname) const;
+
+		int region(const point& p) const { return tiles_[index(p)].region; }
+		bool same_region(const point& a, const point& b) const { return region(a) == region(b); }
+		int region_count() const { return static_cast<int>(region_sizes_.size()); }
+		int region_size(int r) const { return region_sizes_[r]; }
+		bool is_chokepoint(const point& p) const { return (tiles_[index(p)].flags & CHOKEPOINT) != 0; }
+		const std::vector<point>& chokepoints() const { return chokepoints_; }
+		// At least 1, saturates at 255.
+		int clearance(const point& p) const { return tiles_[index(p)].clearance; }
+		float centrality(const point& p) const { return tiles_[index(p)].centrality / 65535.0f; }
+	private:
+		map_analysis() : x_(0), y_(0), width_(0), height_(0), checksum_(0) {}
+		int index(const point& p) const { return (p.y - y_) * width_ + (p.x - x_); }
+		void find_regions(const map_graph& g);
+		void find_chokepoints(const map_graph& g, const std::vector<bool>& open);
+		void find_clearance(const map_graph& g, const std::vector<bool>& open);
+		void find_centrality(const map_graph& g, int samples);
+
+		enum { CHOKEPOINT = 1 };
+		// Eight bytes a tile.
+		struct tile_info
+		{
+			tile_info() : region(0), clearance(0), flags(0), centrality(0) {}
+			int32_t region;
+			uint8_t clearance;
+			uint8_t flags;
+			uint16_t centrality;
+		};
+
+		int x_;
+		int y_;
+		int width_;
+		int height_;
+		// Of the tile types, or the chunk file of a paged map, so a stale file isn't used
+		// after the map is edited.
+		uint32_t checksum_;
+		std::vector<tile_info> tiles_;
+		std::vector<int> region_sizes_;
+		std::vector<point> chokepoints_;
+	};
+
+	// Hashes the tile types of m. For a paged map that hasn't been changed it's the chunk file
+	// that is hashed, which is much quicker than reading in every chunk.
+	uint32_t map_checksum(const logical::map& m);
+}
@@ -16,55 +16,32 @@
 
 #pragma once
 
-#include <memory>
-#include <vector>
-
-#include "hex_fwd.hpp"
-#include "hex_map.hpp"
-#include "hex_tile.hpp"
-#include "node.hpp"
-#include "texture.hpp"
+#include <cstdint>
 
 namespace hex 
 {
-	class hex_object 
+	// A tile of a hex_map, as kept for drawing. The position comes from where the record is
+	// stored, so all there is is the type and where to find the overlays for higher
+	// neighbouring tiles.
+	struct hex_object
 	{
-	public:
-		hex_object(const std::string& type, int x, int y, std::weak_ptr<const hex_map> owner);
-
-		void draw(const point& cam) const;
-	
-		void build();
-		const std::string& type() const { return type_; }
-
-		const hex_object* get_tile_in_dir(enum direction d) const;
-		const hex_object* get_tile_in_dir(const std::string& s) const;
-
-		int x() const { return x_; }
-		int y() const { return y_; }
-
-		tile_type_ptr tile() const { return tile_; }
-
-		void init_neighbors();
-		void neighbors_changed();
-	private:
-		// map coordinates.
-		int x_;
-		int y_;
-
-		tile_type_ptr tile_;
-
-		struct NeighborType {
-			NeighborType() : dirmap(0) {}
-			tile_type_ptr type;
-			unsigned char dirmap;
-		};
-
-		std::vector<NeighborType> neighbors_;
+		hex_object() : type(0), overlay_count(0), first_overlay(0) {}
+		explicit hex_object(uint16_t t) : type(t), overlay_count(0), first_overlay(0) {}
+
+		// Index into the logical map's tile types.
+		uint16_t type;
+		uint16_t overlay_count;
+		// Into the overlay pool of the chunk holding the tile.
+		uint32_t first_overlay;
+	};
 
-		// String representing the base type of this tile.
-		std::string type_;
-		// raw pointer to the map that owns this.
-		std::weak_ptr<const hex_map> owner_map_;
+	// Edges of a higher neighbouring type drawn over a tile, dirmap has a bit set for each
+	// direction that type is in.
+	struct hex_overlay
+	{
+		hex_overlay() : type(0), dirmap(0) {}
+		hex_overlay(uint16_t t, unsigned char d) : type(t), dirmap(d) {}
+		uint16_t type;
+		unsigned char dirmap;
 	};
 }
@@ -0,0 +1,358 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <map>
+#include <queue>
+#include <set>
+
+#include "asserts.hpp"
+#include "hex_logical_tiles.hpp"
+#include "hex_path_abstraction.hpp"
+#include "profile_timer.hpp"
+#include "unit_test.hpp"
+
+namespace hex
+{
+	namespace
+	{
+		typedef std::pair<fixed_cost, int> queue_entry;
+		typedef std::priority_queue<queue_entry, std::vector<queue_entry>, std::greater<queue_entry>> open_list;
+
+		const fixed_cost unreachable = std::numeric_limits<fixed_cost>::max();
+	}
+
+	path_abstraction::path_abstraction(const map_graph_ptr& g, int cluster_size, int entrance_spacing)
+		: graph_(g),
+		  cluster_size_(cluster_size),
+		  cols_((g->width() + cluster_size - 1) / cluster_size),
+		  rows_((g->height() + cluster_size - 1) / cluster_size)
+	{
+		profile::manager pman("path_abstraction");
+		ASSERT_LOG(cluster_size > 0 && entrance_spacing > 0, "Bad cluster size(" << cluster_size << ") or entrance spacing(" << entrance_spacing << ")");
+		for(int cy = 0; cy != rows_; ++cy) {
+			for(int cx = 0; cx != cols_; ++cx) {
+				cluster cl;
+				cl.x = cx * cluster_size_;
+				cl.y = cy * cluster_size_;
+				cl.w = std::min(cluster_size_, g->width() - cl.x);
+				cl.h = std::min(cluster_size_, g->height() - cl.y);
+				clusters_.emplace_back(cl);
+			}
+		}
+
+		// Every edge that crosses between two clusters, grouped by the pair of clusters.
+		std::map<std::pair<int,int>, std::vector<std::pair<int,int>>> crossings;
+		for(int n = 0; n != g->size(); ++n) {
+			const int cn = cluster_of(n);
+			auto nr = g->neighbors(n);
+			for(auto it = nr.begin(); it != nr.end(); ++it) {
+				const int v = it.index();
+				const int cv = cluster_of(v);
+				if(cn < cv) {
+					crossings[std::make_pair(cn, cv)].emplace_back(n, v);
+				}
+			}
+		}
+
+		auto get_node = [this](int tile) {
+			auto res = node_of_tile_.emplace(tile, -1);
+			int& id = res.first->second;
+			if(id < 0) {
+				id = static_cast<int>(nodes_.size());
+				node nd;
+				nd.tile = tile;
+				nd.cluster = cluster_of(tile);
+				nd.slot = static_cast<int>(clusters_[nd.cluster].nodes.size());
+				clusters_[nd.cluster].nodes.emplace_back(id);
+				nodes_.emplace_back(nd);
+			}
+			return id;
+		};
+
+		// Pick transitions spread evenly along each border, at least one per border.
+		for(auto& border : crossings) {
+			const int sz = static_cast<int>(border.second.size());
+			const int count = (sz + entrance_spacing - 1) / entrance_spacing;
+			for(int j = 0; j != count; ++j) {
+				auto& edge = border.second[(2 * j + 1) * sz / (2 * count)];
+				const int na = get_node(edge.first);
+				const int nb = get_node(edge.second);
+				nodes_[na].links.emplace_back(nb);
+				nodes_[nb].links.emplace_back(na);
+			}
+		}
+
+		for(int c = 0; c != cluster_count(); ++c) {
+			build_cluster(c);
+		}
+		LOG_DEBUG("path abstraction: " << cluster_count() << " clusters, " << node_count() << " nodes");
+	}
+
+	int path_abstraction::cluster_of(int tile) const
+	{
+		const int lx = tile % graph_->width();
+		const int ly = tile / graph_->width();
+		return (ly / cluster_size_) * cols_ + lx / cluster_size_;
+	}
+
+	void path_abstraction::build_cluster(int c)
+	{
+		auto& cl = clusters_[c];
+		const int k = static_cast<int>(cl.nodes.size());
+		cl.costs.assign(k * k, -1);
+		std::vector<fixed_cost> dist;
+		for(int i = 0; i != k; ++i) {
+			search_cluster(c, nodes_[cl.nodes[i]].tile, false, &dist, nullptr);
+			for(int j = 0; j != k; ++j) {
+				const int tile = nodes_[cl.nodes[j]].tile;
+				const fixed_cost d = dist[cl.local_index(tile % graph_->width(), tile / graph_->width())];
+				if(d != unreachable) {
+					cl.costs[i * k + j] = d;
+				}
+			}
+		}
+	}
+
+	void path_abstraction::search_cluster(int c, int tile, bool reverse, std::vector<fixed_cost>* dist, std::vector<int>* pred) const
+	{
+		const map_graph& g = *graph_;
+		const cluster& cl = clusters_[c];
+		const int gw = g.width();
+		dist->assign(cl.w * cl.h, unreachable);
+		if(pred != nullptr) {
+			pred->assign(cl.w * cl.h, -1);
+		}
+		const int start = cl.local_index(tile % gw, tile / gw);
+		(*dist)[start] = 0;
+		if(pred != nullptr) {
+			(*pred)[start] = start;
+		}
+		open_list open;
+		open.emplace(0, tile);
+		while(!open.empty()) {
+			const queue_entry top = open.top();
+			open.pop();
+			const int n = top.second;
+			const int ln = cl.local_index(n % gw, n / gw);
+			if(top.first > (*dist)[ln]) {
+				continue;
+			}
+			auto nr = g.neighbors(n);
+			for(auto it = nr.begin(); it != nr.end(); ++it) {
+				const int v = it.index();
+				if(!cl.contains(v % gw, v / gw)) {
+					continue;
+				}
+				const int lv = cl.local_index(v % gw, v / gw);
+				// Searching backwards the step is from v to n, so costs n.
+				const fixed_cost cost = top.first + (reverse ? g.tile_cost(n) : g.tile_cost(v));
+				if(cost < (*dist)[lv]) {
+					(*dist)[lv] = cost;
+					if(pred != nullptr) {
+						(*pred)[lv] = ln;
+					}
+					open.emplace(cost, v);
+				}
+			}
+		}
+	}
+
+	path_abstraction::route path_abstraction::find_route(const point& src, const point& dst) const
+	{
+		//profile::manager pman("find_route");
+		const map_graph& g = *graph_;
+		ASSERT_LOG(g.in_bounds(src), "source node not on map: " << src);
+		ASSERT_LOG(g.in_bounds(dst), "destination node not on map: " << dst);
+		route res;
+		const int s = g.index(src);
+		const int t = g.index(dst);
+		if(s == t) {
+			res.waypoints.emplace_back(src);
+			res.first_leg.emplace_back(src);
+			return res;
+		}
+
+		const int cs = cluster_of(s);
+		const int ct = cluster_of(t);
+		const cluster& src_cl = clusters_[cs];
+		const cluster& dst_cl = clusters_[ct];
+		const int gw = g.width();
+		std::vector<fixed_cost> src_dist, dst_dist;
+		std::vector<int> src_pred;
+		search_cluster(cs, s, false, &src_dist, &src_pred);
+		search_cluster(ct, t, true, &dst_dist, nullptr);
+		auto src_cost = [&](int tile) { return src_dist[src_cl.local_index(tile % gw, tile / gw)]; };
+		auto dst_cost = [&](int tile) { return dst_dist[dst_cl.local_index(tile % gw, tile / gw)]; };
+
+		// A* over the abstract nodes, plus two extra nodes for src and dst.
+		const int start_node = node_count();
+		const int goal_node = node_count() + 1;
+		auto tile_of = [&](int id) {
+			return id == start_node ? s : id == goal_node ? t : nodes_[id].tile;
+		};
+		auto heuristic = [&](int id) {
+			return logical::distance(g.position(tile_of(id)), dst) * g.min_cost();
+		};
+		std::vector<fixed_cost> d(node_count() + 2, unreachable);
+		std::vector<int> pred(node_count() + 2, -1);
+		open_list open;
+		auto relax = [&](int from, int to, fixed_cost c) {
+			if(d[from] + c < d[to]) {
+				d[to] = d[from] + c;
+				pred[to] = from;
+				open.emplace(d[to] + heuristic(to), to);
+			}
+		};
+		d[start_node] = 0;
+		open.emplace(heuristic(start_node), start_node);
+		while(!open.empty()) {
+			const queue_entry top = open.top();
+			open.pop();
+			const int id = top.second;
+			if(id == goal_node) {
+				break;
+			}
+			if(top.first > d[id] + heuristic(id)) {
+				continue;
+			}
+			if(id == start_node) {
+				for(int b : src_cl.nodes) {
+					if(src_cost(nodes_[b].tile) != unreachable) {
+						relax(id, b, src_cost(nodes_[b].tile));
+					}
+				}
+				if(cs == ct && src_cost(t) != unreachable) {
+					relax(id, goal_node, src_cost(t));
+				}
+				continue;
+			}
+			const node& a = nodes_[id];
+			const cluster& cl = clusters_[a.cluster];
+			const int k = static_cast<int>(cl.nodes.size());
+			for(int j = 0; j != k; ++j) {
+				const fixed_cost c = cl.costs[a.slot * k + j];
+				if(c >= 0 && cl.nodes[j] != id) {
+					relax(id, cl.nodes[j], c);
+				}
+			}
+			for(int b : a.links) {
+				relax(id, b, g.tile_cost(nodes_[b].tile));
+			}
+			if(a.cluster == ct && dst_cost(a.tile) != unreachable) {
+				relax(id, goal_node, dst_cost(a.tile));
+			}
+		}
+		if(d[goal_node] == unreachable) {
+			return res;
+		}
+
+		res.cost = d[goal_node];
+		for(int id = goal_node; id != -1; id = pred[id]) {
+			const point p = g.position(tile_of(id));
+			if(res.waypoints.empty() || res.waypoints.back() != p) {
+				res.waypoints.emplace_back(p);
+			}
+		}
+		std::reverse(res.waypoints.begin(), res.waypoints.end());
+
+		const point& next = res.waypoints[1];
+		const int next_tile = g.index(next);
+		if(cluster_of(next_tile) == cs) {
+			for(int v = src_cl.local_index(next_tile % gw, next_tile / gw);; v = src_pred[v]) {
+				res.first_leg.emplace_back(g.position((src_cl.y + v / src_cl.w) * gw + src_cl.x + v % src_cl.w));
+				if(src_pred[v] == v) {
+					break;
+				}
+			}
+			std::reverse(res.first_leg.begin(), res.first_leg.end());
+		} else {
+			// Stepping straight across the border from src.
+			res.first_leg.emplace_back(src);
+			res.first_leg.emplace_back(next);
+		}
+		return res;
+	}
+
+	void path_abstraction::tiles_changed(const map_graph_ptr& g, const std::vector<point>& changes)
+	{
+		ASSERT_LOG(g->width() == graph_->width() && g->height() == graph_->height(), "Map graph changed size, rebuild the abstraction instead.");
+		graph_ = g;
+		std::set<int> dirty;
+		for(auto& p : changes) {
+			dirty.emplace(cluster_of(g->index(p)));
+		}
+		for(int c : dirty) {
+			build_cluster(c);
+		}
+	}
+}
+
+UNIT_TEST(path_abstraction_test)
+{
+	// Grass with a wall of mountains down column 6, except for a gap at (6,5).
+	std::vector<hex::logical::const_tile_ptr> types;
+	types.emplace_back(std::make_shared<hex::logical::tile>("grass", "Grass", 1.0f, 1.0f));
+	types.emplace_back(std::make_shared<hex::logical::tile>("mountains", "Mountains", 10.0f, 3.0f));
+	const int w = 16;
+	const int h = 12;
+	std::vector<hex::logical::map::type_index> tiles(w * h, 0);
+	for(int y = 0; y != h; ++y) {
+		tiles[y * w + 6] = y == 5 ? 0 : 1;
+	}
+	auto m = std::make_shared<hex::logical::map>(w, h, types, tiles);
+	auto g = std::make_shared<hex::map_graph>(*m);
+	// With a transition at every border tile the abstraction finds the cheapest routes.
+	hex::path_abstraction abs(g, 4, 1);
+
+	auto check_routes = [&]() {
+		hex::graph_t flat(g, 0, 0, w, h);
+		hex::result_path path;
+		for(auto& src : std::vector<point>{ point(0, 0), point(2, 9), point(5, 5), point(15, 11) }) {
+			for(int n = 0; n != g->size(); ++n) {
+				const point dst = g->position(n);
+				CHECK(hex::find_path(flat, src, dst, &path), "no path from " << src << " to " << dst);
+				auto route = abs.find_route(src, dst);
+				CHECK_EQ(route.cost, hex::path_cost(*g, path));
+				if(src == dst) {
+					continue;
+				}
+				// The first leg is a cheapest path to the first waypoint, and the route carries
+				// on from there without losing anything.
+				auto& leg = route.first_leg;
+				CHECK(leg.size() >= 2 && leg.front() == src && leg.back() == route.waypoints[1], "first leg doesn't join " << src << " and " << route.waypoints[1]);
+				for(int i = 1; i < static_cast<int>(leg.size()); ++i) {
+					CHECK_EQ(hex::logical::distance(leg[i - 1], leg[i]), 1);
+				}
+				CHECK(hex::find_path(flat, src, leg.back(), &path), "no path from " << src << " to " << leg.back());
+				CHECK_EQ(hex::path_cost(*g, leg), hex::path_cost(*g, path));
+				CHECK_EQ(hex::path_cost(*g, leg) + abs.find_route(leg.back(), dst).cost, route.cost);
+			}
+		}
+	};
+	check_routes();
+
+	// Closing the gap and opening it again only rebuilds the clusters around it.
+	for(auto& tile : std::vector<std::string>{ "mountains", "grass" }) {
+		const int rev = m->revision();
+		m->set_tile(6, 5, tile);
+		g = std::make_shared<hex::map_graph>(*m);
+		abs.tiles_changed(g, m->get_changes_since(rev));
+		check_routes();
+	}
+}
@@ -0,0 +1,92 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "geometry.hpp"
+#include "hex_pathfinding.hpp"
+
+namespace hex
+{
+	// Hierarchical (HPA*) view of a map graph. The map is cut into square clusters, a few
+	// transition tiles are picked along every border between two clusters and the costs
+	// between the transitions of each cluster are precomputed. Long routes are then found
+	// by searching this much smaller graph, only the part of the route inside the starting
+	// cluster is turned into an actual tile path.
+	// Only terrain is considered, units are ignored.
+	class path_abstraction
+	{
+	public:
+		explicit path_abstraction(const map_graph_ptr& g, int cluster_size=16, int entrance_spacing=16);
+
+		struct route
+		{
+			route() : cost(0) {}
+			// src, the transition tiles passed through, then dst. Empty if dst can't be reached.
+			result_path waypoints;
+			// Tile path from src to waypoints[1].
+			result_path first_leg;
+			fixed_cost cost;
+		};
+		route find_route(const point& src, const point& dst) const;
+
+		// Called with the new graph after the cost of the tiles in changes was altered. Only
+		// the clusters containing those tiles are recalculated.
+		void tiles_changed(const map_graph_ptr& g, const std::vector<point>& changes);
+
+		int cluster_count() const { return static_cast<int>(clusters_.size()); }
+		int node_count() const { return static_cast<int>(nodes_.size()); }
+	private:
+		struct cluster
+		{
+			int x, y, w, h;
+			// Abstract nodes inside the cluster.
+			std::vector<int> nodes;
+			// nodes.size() squared table of the cheapest way between any two nodes, staying
+			// inside the cluster. -1 means there isn't one.
+			std::vector<fixed_cost> costs;
+			bool contains(int lx, int ly) const { return lx >= x && ly >= y && lx < x + w && ly < y + h; }
+			int local_index(int lx, int ly) const { return (ly - y) * w + (lx - x); }
+		};
+		struct node
+		{
+			int tile;
+			int cluster;
+			// Position in the clusters node list.
+			int slot;
+			// Nodes in neighbouring clusters that can be stepped to directly.
+			std::vector<int> links;
+		};
+
+		int cluster_of(int tile) const;
+		void build_cluster(int c);
+		// Dijkstra restricted to cluster c, starting from tile. If reverse is set dist holds
+		// the cost of getting *to* tile instead. Both arrays use the clusters local indices.
+		void search_cluster(int c, int tile, bool reverse, std::vector<fixed_cost>* dist, std::vector<int>* pred) const;
+
+		map_graph_ptr graph_;
+		int cluster_size_;
+		int cols_;
+		int rows_;
+		std::vector<cluster> clusters_;
+		std::vector<node> nodes_;
+		// Abstract node for the tiles that have one.
+		std::unordered_map<int,int> node_of_tile_;
+	};
+}
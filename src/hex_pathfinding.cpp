@@ -14,234 +14,852 @@
 	limitations under the License.
 */
 
-#include <boost/graph/dijkstra_shortest_paths.hpp>
-#include <boost/graph/graph_traits.hpp>
-#include <boost/property_map/property_map.hpp>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <queue>
 
+#include "asserts.hpp"
+#include "creature.hpp"
+#include "hex_line_of_sight.hpp"
 #include "hex_logical_tiles.hpp"
 #include "hex_pathfinding.hpp"
+#include "json.hpp"
 #include "profile_timer.hpp"
+#include "thread_pool.hpp"
+#include "unit_test.hpp"
 #include "units.hpp"
 
 namespace hex
 {
-	// XXX Modify these to work with hex::logical::map
-	hex_graph_ptr create_graph(const game::state& gs, int x, int y, int w, int h)
+	namespace
 	{
-		//profile::manager pman("create_graph");
-		
-		std::vector<point> vertices;
-		std::vector<edge> edges;
-		std::vector<cost> weights;
+		// (cost, vertex) pairs, lowest cost on top. Ties are broken on the vertex index so
+		// that results don't depend on the order in which things were pushed.
+		typedef std::pair<fixed_cost, int> queue_entry;
 
-		auto& map = gs.get_map();
+		// Working memory for searches, one per thread and kept between searches so that they 
+		// don't have to allocate. Vertices are stamped with the generation of the search that
+		// last touched them, anything with an older stamp counts as unvisited, so nothing needs
+		// clearing between searches.
+		class search_scratch
+		{
+		public:
+			search_scratch() : generation_(0) {}
 
-		if(w == 0) {
-			w = map->width();
-		}
-		if(h == 0) {
-			h = map->height();
+			static search_scratch& get();
+
+			// Starts a new search over a graph of n vertices.
+			void reset(int n) {
+				if(static_cast<int>(stamp_.size()) < n) {
+					dist_.resize(n);
+					pred_.resize(n);
+					stamp_.resize(n, 0);
+				}
+				if(++generation_ == 0) {
+					std::fill(stamp_.begin(), stamp_.end(), 0);
+					generation_ = 1;
+				}
+				heap.clear();
+			}
+			fixed_cost dist(int n) const { return stamp_[n] == generation_ ? dist_[n] : std::numeric_limits<fixed_cost>::max(); }
+			int pred(int n) const { return stamp_[n] == generation_ ? pred_[n] : -1; }
+			void set(int n, fixed_cost d, int p) {
+				stamp_[n] = generation_;
+				dist_[n] = d;
+				pred_[n] = p;
+			}
+
+			// Open list, a binary heap with the lowest cost on top. Ties are broken on the vertex 
+			// index so that results don't depend on the order in which things were pushed.
+			std::vector<queue_entry> heap;
+			void push(fixed_cost c, int n) {
+				heap.emplace_back(c, n);
+				std::push_heap(heap.begin(), heap.end(), std::greater<queue_entry>());
+			}
+			queue_entry pop() {
+				std::pop_heap(heap.begin(), heap.end(), std::greater<queue_entry>());
+				const queue_entry top = heap.back();
+				heap.pop_back();
+				return top;
+			}
+		private:
+			std::vector<fixed_cost> dist_;
+			std::vector<int> pred_;
+			std::vector<unsigned> stamp_;
+			unsigned generation_;
+		};
+
+		// VS2013 has no thread_local, and __declspec(thread) only works for plain data. So 
+		// each thread gets a pointer to a scratch area that is owned here.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+		__declspec(thread) search_scratch* thread_scratch = nullptr;
+#else
+		thread_local search_scratch* thread_scratch = nullptr;
+#endif
+		std::mutex scratch_mutex;
+		std::vector<std::unique_ptr<search_scratch>> scratch_areas;
+
+		search_scratch& search_scratch::get()
+		{
+			if(thread_scratch == nullptr) {
+				std::lock_guard<std::mutex> lock(scratch_mutex);
+				scratch_areas.emplace_back(new search_scratch());
+				thread_scratch = scratch_areas.back().get();
+			}
+			return *thread_scratch;
 		}
 
-		// Scan through enemy entities add to dictionary keyed on position.
-		// For each valid surrounding position of the enemy entity add this to a set of positions.
-		// enemies on a tile make that tile unavailable as a desitination.
-		// surrounding positions have no edges from them to other nodes. other nodes may
-		// have edges to them.
-		// XXX todo.
+		fixed_cost gcd(fixed_cost a, fixed_cost b)
+		{
+			while(b != 0) {
+				const fixed_cost t = a % b;
+				a = b;
+				b = t;
+			}
+			return a;
+		}
 
-		//std::set<point> friendly_units;
-		std::map<point, game::unit_ptr> enemy_units;
-		std::set<point> surrounding_positions;
-		auto cp = gs.get_entities().front()->get_owner();
-		for(auto& u : gs.get_entities()) {
-			auto owner = u->get_owner();
-			auto& pos = u->get_position();
-			if(cp->team() != owner->team()) {
-				enemy_units[pos] = u;
-				auto surrounds = map->get_surrounding_positions(pos.x, pos.y);
-				for(auto& t : surrounds) {
-					surrounding_positions.emplace(t);
+		// Calls fn(target_vertex, target_position, local_index) for every neighbour of p that is 
+		// inside the graph window and may be entered. Does nothing if p is under enemy
+		// zone of control, unless it is where the unit started.
+		template<typename F>
+		void for_each_passable_neighbour(const graph_t& graph, const point& src, const point& p, F fn)
+		{
+			if(p != src && (graph.flags(p) & OVERLAY_ZOC)) {
+				return;
+			}
+			const map_graph& base = *graph.base;
+			auto nr = base.neighbors(p);
+			for(auto it = nr.begin(); it != nr.end(); ++it) {
+				const point q = *it;
+				if(!graph.contains(q)) {
+					continue;
 				}
-			} else {
-				//friendly_units.emplace(pos);
-			}
-		}
-		// remove enemy entities from surrounding positions
-		auto team_current = gs.get_entities().front()->get_owner()->team();
-		for(auto& e : gs.get_entities()) {
-			auto e_team = e->get_owner()->team();
-			if(e_team != team_current) {
-				auto it = surrounding_positions.find(e->get_position());
-				if(it != surrounding_positions.end()) {
-					surrounding_positions.erase(it);
-				}
-			}
-		}
-
-		std::map<point, int> reverse_map;
-
-		// find vertices and edges to construct the graph.
-		vertices.reserve(w*h);
-		for(int m = y; m != y+h; ++m) {
-			for(int n = x; n != x+w; ++n) {
-				point n1(n, m);
-				auto surrounds = map->get_surrounding_positions(n1);
-				// scan through entities for units at t
-				auto it = enemy_units.find(n1);
-				if(it == enemy_units.end()) {
-					vertices.emplace_back(n1);
-					reverse_map[n1] = vertices.size()-1;
-					for(auto& n2 : surrounds) {
-						if(n2.x >= x && n2.x < x+w 
-							&& n2.y >= y && n2.y < y+h
-							&& enemy_units.find(n2) == enemy_units.end()) {
-							const bool src_node_zoc = surrounding_positions.find(n1) != surrounding_positions.end();
-							const bool dst_node_zoc = surrounding_positions.find(n2) != surrounding_positions.end();
-							if(!src_node_zoc || !dst_node_zoc) {
-								//std::cerr << "Adding edge from " << n1 << " to " << n2 << "\n";
-								edges.emplace_back(n1, n2);
-								weights.emplace_back(map->get_tile_at(n2)->get_cost());
+				const int lq = graph.local_index(q);
+				if(graph.overlay[lq] & OVERLAY_ENEMY) {
+					continue;
+				}
+				fn(it.index(), q, lq);
+			}
+		}
+
+		// Dial's algorithm. Every path cost is a multiple of the cost step and no edge costs
+		// more than max_cost(), so a ring of max_cost()/step + 1 buckets is enough to hold 
+		// all the open vertices and we can just walk the buckets in order.
+		// visit(vertex, position, local_index, cost) is called once for each vertex, in order of
+		// cost, as soon as its cost is final. Returning false from it ends the search.
+		template<typename F>
+		void bucket_search(const graph_t& graph, const point& src, fixed_cost limit, std::vector<fixed_cost>& d, std::vector<int>* pred, F visit)
+		{
+			const map_graph& base = *graph.base;
+			const fixed_cost step = base.cost_step();
+			const int nbuckets = base.max_cost() / step + 1;
+			std::vector<std::vector<int>> buckets(nbuckets);
+			d.assign(graph.overlay.size(), std::numeric_limits<fixed_cost>::max());
+			if(pred != nullptr) {
+				pred->assign(graph.overlay.size(), -1);
+				(*pred)[graph.local_index(src)] = graph.local_index(src);
+			}
+			d[graph.local_index(src)] = 0;
+			buckets[0].emplace_back(base.index(src));
+			int pending = 1;
+			for(fixed_cost dist = 0; pending > 0 && dist <= limit; dist += step) {
+				auto& bucket = buckets[(dist / step) % nbuckets];
+				while(!bucket.empty()) {
+					const int n = bucket.back();
+					bucket.pop_back();
+					--pending;
+					const point p = base.position(n);
+					const int lp = graph.local_index(p);
+					if(d[lp] != dist) {
+						// stale entry, we already found a shorter way here.
+						continue;
+					}
+					if(!visit(n, p, lp, dist)) {
+						return;
+					}
+					for_each_passable_neighbour(graph, src, p, [&](int v, const point& q, int lq) {
+						const fixed_cost c = dist + graph.tile_cost(q, lq);
+						if(c < d[lq] && c <= limit) {
+							d[lq] = c;
+							if(pred != nullptr) {
+								(*pred)[lq] = lp;
 							}
+							buckets[(c / step) % nbuckets].emplace_back(v);
+							++pending;
+						}
+					});
+				}
+			}
+		}
+
+		// Enemy units make their tile impassable and put all the tiles around them under
+		// zone of control. Friendly units only stop their tile being used as a destination.
+		void mark_unit(graph_t& graph, const point& pos, bool enemy)
+		{
+			auto& base = *graph.base;
+			if(enemy) {
+				if(graph.contains(pos)) {
+					graph.overlay[graph.local_index(pos)] |= OVERLAY_ENEMY;
+				}
+				for(auto p : base.neighbors(pos)) {
+					if(graph.contains(p)) {
+						graph.overlay[graph.local_index(p)] |= OVERLAY_ZOC;
+					}
+				}
+			} else if(graph.contains(pos)) {
+				graph.overlay[graph.local_index(pos)] |= OVERLAY_OCCUPIED;
+			}
+		}
+
+		// Fills in the overlay a tile at a time from the unit indexes kept by game::state.
+		void mark_tiles(graph_t& graph, const game::occupancy& occ, const game::zone_of_control& zoc, const team* t)
+		{
+			for(int ly = 0; ly != graph.h; ++ly) {
+				for(int lx = 0; lx != graph.w; ++lx) {
+					const point p(graph.x + lx, graph.y + ly);
+					unsigned char flags = 0;
+					if(zoc.under_enemy_zoc(p, t)) {
+						flags |= OVERLAY_ZOC;
+					}
+					if(occ.occupied(p)) {
+						if(occ.has_enemy(p, t)) {
+							flags |= OVERLAY_ENEMY;
+						}
+						if(occ.has_team(p, t)) {
+							flags |= OVERLAY_OCCUPIED;
 						}
 					}
+					graph.overlay[ly * graph.w + lx] = flags;
 				}
 			}
 		}
 
-		hex_graph_ptr graph = std::make_shared<graph_t>(vertices.size());
-		graph->reverse_map.swap(reverse_map);
-		graph->vertices.swap(vertices);
-		WeightMap weightmap = boost::get(boost::edge_weight, graph->graph);
-		size_t n = 0;
-		for(auto& ep : edges) {
-			edge_descriptor e;
-			bool inserted;
-			boost::tie(e, inserted) = boost::add_edge(graph->reverse_map[ep.first], graph->reverse_map[ep.second], graph->graph);
-			weightmap[e] = map->get_tile_at(graph->vertices[e.m_target])->get_cost();//weights[n++];
+		// Marking each unit costs about as much as looking at six tiles.
+		bool mark_by_unit(size_t units, int w, int h)
+		{
+			return units * 6 < static_cast<size_t>(w * h);
+		}
+
+		// Window around src that a search for max_cost can reach, clipped to the map.
+		void cost_window(const map_graph& base, const point& src, float max_cost, int* x, int* y, int* w, int* h)
+		{
+			const int max_area = static_cast<int>(max_cost*4.0f+1.0f);
+			const int x1 = std::max(src.x - max_area/2, 0);
+			const int y1 = std::max(src.y - max_area/2, 0);
+			const int x2 = std::min(src.x - max_area/2 + max_area, base.width());
+			const int y2 = std::min(src.y - max_area/2 + max_area, base.height());
+			*x = x1;
+			*y = y1;
+			*w = std::max(x2 - x1, 1);
+			*h = std::max(y2 - y1, 1);
 		}
 
+		// Follows pred back from the local index v to the start of the search.
+		result_path build_path(const graph_t& graph, const std::vector<int>& pred, int v)
+		{
+			result_path path;
+			for(;; v = pred[v]) {
+				path.emplace_back(graph.x + v % graph.w, graph.y + v / graph.w);
+				if(pred[v] == v) {
+					break;
+				}
+			}
+			std::reverse(path.begin(), path.end());
+			return path;
+		}
+	}
+
+	map_graph::map_graph(const logical::map& m)
+		: x_(m.x()),
+		  y_(m.y()),
+		  width_(m.width()),
+		  height_(m.height()),
+		  min_cost_(0),
+		  max_cost_(0),
+		  cost_step_(0),
+		  tiles_(m.get_tile_store())
+	{
+		for(auto c : m.type_costs()) {
+			const fixed_cost fc = to_fixed_cost(c);
+			ASSERT_LOG(fc >= 0, "Tile type has a negative cost: " << c);
+			min_cost_ = type_costs_.empty() ? fc : std::min(min_cost_, fc);
+			max_cost_ = std::max(max_cost_, fc);
+			cost_step_ = gcd(cost_step_, fc);
+			type_costs_.emplace_back(fc);
+		}
+		if(cost_step_ == 0) {
+			cost_step_ = 1;
+		}
+	}
+
+	void map_graph::get_row_costs(int xx, int yy, int count, fixed_cost* out) const
+	{
+		logical::map::type_index types[logical::map::chunk_size];
+		for(int lx = xx - x_; count > 0; ) {
+			const int n = std::min(count, static_cast<int>(logical::map::chunk_size));
+			tiles_->get_row(lx, yy - y_, n, types);
+			for(int i = 0; i != n; ++i) {
+				*out++ = type_costs_[types[i]];
+			}
+			lx += n;
+			count -= n;
+		}
+	}
+
+	graph_t::graph_t(const map_graph_ptr& g, int xx, int yy, int ww, int hh)
+		: base(g),
+		  x(xx),
+		  y(yy),
+		  w(ww),
+		  h(hh),
+		  overlay(ww * hh, 0)
+	{
+	}
+
+	void graph_t::load_costs()
+	{
+		// Parts of the window off the map are never searched, so are left at 0.
+		costs.assign(w * h, 0);
+		for(int ly = 0; ly != h; ++ly) {
+			int x1 = x;
+			int x2 = x + w;
+			while(x1 < x2 && !base->in_bounds(x1, y + ly)) {
+				++x1;
+			}
+			while(x2 > x1 && !base->in_bounds(x2 - 1, y + ly)) {
+				--x2;
+			}
+			base->get_row_costs(x1, y + ly, x2 - x1, &costs[ly * w + x1 - x]);
+		}
+	}
+
+	hex_graph_ptr create_graph(const game::state& gs, int x, int y, int w, int h)
+	{
+		return create_graph(gs, gs.get_entities().front()->get_owner()->team(), x, y, w, h);
+	}
+
+	search_view::search_view(const game::state& gs)
+		: graph(gs.get_graph()),
+		  occupancy(&gs.get_occupancy()),
+		  zoc(&gs.get_zone_of_control())
+	{
+		ASSERT_LOG(graph != nullptr, "No map graph available, was a map set on the game state?");
+		units.reserve(gs.get_entities().size());
+		for(auto& u : gs.get_entities()) {
+			units.emplace_back(u->get_position(), u->get_owner()->team());
+		}
+	}
+
+	hex_graph_ptr create_graph(const game::state& gs, const team_ptr& team, int x, int y, int w, int h)
+	{
+		auto& base = gs.get_graph();
+		ASSERT_LOG(base != nullptr, "No map graph available, was a map set on the game state?");
+		if(w == 0) {
+			w = base->width();
+		}
+		if(h == 0) {
+			h = base->height();
+		}
+		auto graph = std::make_shared<graph_t>(base, x, y, w, h);
+		auto& units = gs.get_entities();
+		if(mark_by_unit(units.size(), w, h)) {
+			for(auto& u : units) {
+				mark_unit(*graph, u->get_position(), u->get_owner()->team() != team);
+			}
+		} else {
+			mark_tiles(*graph, gs.get_occupancy(), gs.get_zone_of_control(), team.get());
+		}
 		return graph;
 	}
 
-	hex_graph_ptr create_cost_graph(const game::state& gs, const point& src, float max_cost)
+	hex_graph_ptr create_graph(const search_view& view, const team_ptr& team, int x, int y, int w, int h)
 	{
-		auto& map = gs.get_map();
-		int max_area = static_cast<int>(max_cost*4.0f+1.0f);
-		int x = src.x - max_area/2;
-		int w = max_area;
-		if(x < 0) {
-			w = w + x;
-			x = 0;
-		} else if(x >= static_cast<int>(map->width())) {
-			w = w - (x - map->width() - 1);
-			x = map->width() - 1;
+		//profile::manager pman("create_graph");
+		auto& base = view.graph;
+
+		if(w == 0) {
+			w = base->width();
 		}
-		int y = src.y - max_area/2;
-		int h = max_area;
-		if(y < 0) {
-			h = h + y;
-			y = 0;
-		} else if(y >= static_cast<int>(map->height())) {
-			h = h - (y - map->height() - 1);
-			y = map->height() - 1;
+		if(h == 0) {
+			h = base->height();
 		}
 
-		return create_graph(gs, x, y, w, h);
+		auto graph = std::make_shared<graph_t>(base, x, y, w, h);
+
+		if(mark_by_unit(view.units.size(), w, h)) {
+			for(auto& u : view.units) {
+				mark_unit(*graph, u.pos, u.team != team);
+			}
+		} else {
+			mark_tiles(*graph, *view.occupancy, *view.zoc, team.get());
+		}
+		return graph;
+	}
+
+	hex_graph_ptr create_cost_graph(const game::state& gs, const point& src, float max_cost)
+	{
+		return create_cost_graph(gs, gs.get_entities().front()->get_owner()->team(), src, max_cost);
+	}
+
+	hex_graph_ptr create_cost_graph(const game::state& gs, const team_ptr& team, const point& src, float max_cost)
+	{
+		int x, y, w, h;
+		cost_window(*gs.get_graph(), src, max_cost, &x, &y, &w, &h);
+		auto graph = create_graph(gs, team, x, y, w, h);
+		graph->load_costs();
+		return graph;
 	}
 
-	result_list find_available_moves(hex_graph_ptr graph, const point& src, float max_cost)
+	hex_graph_ptr create_cost_graph(const search_view& view, const team_ptr& team, const point& src, float max_cost)
+	{
+		int x, y, w, h;
+		cost_window(*view.graph, src, max_cost, &x, &y, &w, &h);
+		auto graph = create_graph(view, team, x, y, w, h);
+		graph->load_costs();
+		return graph;
+	}
+
+	result_list find_available_moves(hex_graph_ptr graph, const point& src, float max_cost, std::vector<int>* pred, std::vector<fixed_cost>* dist)
 	{
 		//profile::manager pman("find_available_moves");
-		
+		ASSERT_LOG(graph->contains(src), "source node not in graph.");
+		std::vector<fixed_cost> local_dist;
+		std::vector<fixed_cost>& d = dist != nullptr ? *dist : local_dist;
+		const fixed_cost limit = to_fixed_cost(max_cost);
+		bucket_search(*graph, src, limit, d, pred, [](int, const point&, int, fixed_cost) { return true; });
+
+		// Tiles with other units on them can be moved through but not stopped on.
 		result_list res;
+		for(int n = 0; n != static_cast<int>(d.size()); ++n) {
+			const point p(graph->x + n % graph->w, graph->y + n / graph->w);
+			if(d[n] <= limit && (p == src || !(graph->overlay[n] & OVERLAY_OCCUPIED))) {
+				res.emplace_back(p, from_fixed_cost(d[n]));
+			}
+		}
+		return res;
+	}
+
+	result_path find_path(hex_graph_ptr graph, const point& src, const point& dst)
+	{
+		result_path path;
+		find_path(*graph, src, dst, &path);
+		return path;
+	}
+
+	bool find_path(const graph_t& graph, const point& src, const point& dst, result_path* path)
+	{
+		//profile::manager pman("find_path");
+		ASSERT_LOG(graph.contains(src), "source node not in graph.");
+		ASSERT_LOG(graph.contains(dst), "destination node not in graph.");
+		const map_graph& base = *graph.base;
+		path->clear();
 
-		std::vector<cost> d(boost::num_vertices(graph->graph));
-		std::vector<vertex> p(boost::num_vertices(graph->graph));
-		boost::dijkstra_shortest_paths(graph->graph, graph->reverse_map[src],
-			boost::predecessor_map(boost::make_iterator_property_map(p.begin(), boost::get(boost::vertex_index, graph->graph)))
-				.distance_map(boost::make_iterator_property_map(d.begin(), boost::get(boost::vertex_index, graph->graph))));
-		
-		boost::graph_traits<hex_graph>::vertex_iterator vi, vend;
-		for (boost::tie(vi, vend) = boost::vertices(graph->graph); vi != vend; ++vi) {
-			if(d[*vi] < max_cost) {
-				res.emplace_back(graph->vertices[*vi], d[*vi]);
+		// The heuristic is the hex distance scaled by the cheapest tile, so it never
+		// over-estimates and the first time we pop dst we have the shortest path.
+		auto heuristic = [&base, &dst](const point& p) {
+			return logical::distance(p, dst) * base.min_cost();
+		};
+
+		search_scratch& scratch = search_scratch::get();
+		scratch.reset(base.size());
+		auto& open = scratch.heap;
+		const int s = base.index(src);
+		const int t = base.index(dst);
+		scratch.set(s, 0, s);
+		scratch.push(heuristic(src), s);
+		while(!open.empty()) {
+			const queue_entry top = scratch.pop();
+			const int n = top.second;
+			if(n == t) {
+				// Count the steps first so the path is only sized once.
+				int len = 1;
+				for(int v = t; scratch.pred(v) != v; v = scratch.pred(v)) {
+					++len;
+				}
+				path->resize(len);
+				for(int v = t; len > 0; v = scratch.pred(v)) {
+					(*path)[--len] = base.position(v);
+				}
+				return true;
+			}
+			const point p = base.position(n);
+			const fixed_cost dp = scratch.dist(n);
+			if(top.first > dp + heuristic(p)) {
+				continue;
 			}
+			for_each_passable_neighbour(graph, src, p, [&](int v, const point& q, int lq) {
+				const fixed_cost c = dp + graph.tile_cost(q, lq);
+				if(c < scratch.dist(v)) {
+					scratch.set(v, c, n);
+					scratch.push(c + heuristic(q), v);
+				}
+			});
 		}
+		return false;
+	}
 
-		// remove tiles that have friendly entities on them, from the results.
-		/*res.erase(std::remove_if(res.begin(), res.end(), [&friendly_units](const hex_object* t){ 
-			return friendly_units.find(point(t->x(), t->y())) != friendly_units.end();
-		}), res.end());*/
+	result_path get_path(const graph_t& graph, const std::vector<int>& pred, const point& dst)
+	{
+		if(!graph.contains(dst) || pred[graph.local_index(dst)] < 0) {
+			return result_path();
+		}
+		return build_path(graph, pred, graph.local_index(dst));
+	}
+
+	attack_position_list find_attack_positions(hex_graph_ptr graph, const point& src, float max_cost, int range, const game::unit_list& targets, const game::occupancy& occupants)
+	{
+		//profile::manager pman("find_attack_positions");
+		ASSERT_LOG(graph->contains(src), "source node not in graph.");
+		if(targets.empty()) {
+			return attack_position_list();
+		}
 
+		// Mark every tile in the window that is in range of a target. Each tile gets a list of
+		// (target, next) entries chained through goals.
+		std::vector<int> first_goal(graph->overlay.size(), -1);
+		std::vector<std::pair<int,int>> goals;
+		for(int i = 0; i != static_cast<int>(targets.size()); ++i) {
+			const point& tp = targets[i]->get_position();
+			for(auto& q : logical::spiral(tp, range)) {
+				if(graph->contains(q)) {
+					const int lq = graph->local_index(q);
+					goals.emplace_back(i, first_goal[lq]);
+					first_goal[lq] = static_cast<int>(goals.size()) - 1;
+				}
+			}
+		}
+
+		std::vector<attack_position> found(targets.size());
+		std::vector<fixed_cost> d;
+		std::vector<int> pred;
+		int remaining = static_cast<int>(targets.size());
+		bucket_search(*graph, src, to_fixed_cost(max_cost), d, &pred, [&](int, const point& p, int lp, fixed_cost dist) {
+			// Tiles are visited cheapest first, so the first tile found for a target is the best one.
+			if(first_goal[lp] < 0 || (p != src && (graph->overlay[lp] & OVERLAY_OCCUPIED))) {
+				return true;
+			}
+			for(int g = first_goal[lp]; g >= 0; g = goals[g].second) {
+				auto& ap = found[goals[g].first];
+				if(ap.target == nullptr && !line_blocked(p, targets[goals[g].first]->get_position(), [&](const point& q) { return q != src && occupants.occupied(q); })) {
+					ap.target = targets[goals[g].first];
+					ap.loc = p;
+					ap.path_cost = from_fixed_cost(dist);
+					ap.path = build_path(*graph, pred, lp);
+					--remaining;
+				}
+			}
+			return remaining > 0;
+		});
+
+		attack_position_list res;
+		for(auto& ap : found) {
+			if(ap.target != nullptr) {
+				res.emplace_back(ap);
+			}
+		}
 		return res;
 	}
 
+	std::vector<reachable_moves> find_all_available_moves(const search_view& view, const std::vector<move_request>& requests)
+	{
+		//profile::manager pman("find_all_available_moves");
+		std::vector<reachable_moves> res(requests.size());
+		threading::pool::get().parallel_for(static_cast<int>(requests.size()), [&](int n) {
+			auto& req = requests[n];
+			auto& rm = res[n];
+			rm.src = req.src;
+			rm.max_cost = req.max_cost;
+			rm.graph = create_cost_graph(view, req.team, req.src, req.max_cost);
+			rm.moves = find_available_moves(rm.graph, rm.src, rm.max_cost, &rm.pred, &rm.dist);
+		});
+		return res;
+	}
 
-	struct found_goal {}; // exception for termination
+	fixed_cost path_cost(const map_graph& g, const result_path& path)
+	{
+		fixed_cost c = 0;
+		for(auto it = path.begin() + (path.empty() ? 0 : 1); it != path.end(); ++it) {
+			ASSERT_LOG(g.in_bounds(*it), "Point " << *it << " in path isn't on the map.");
+			c += g.tile_cost(*it);
+		}
+		return c;
+	}
+
+	reachability_cache::reachability_cache()
+		: hits_(0),
+		  misses_(0),
+		  invalidations_(0)
+	{
+	}
+
+	reachable_moves_ptr reachability_cache::get(const game::state& gs, const game::unit_ptr& u)
+	{
+		auto& entry = entries_[u->get_uuid()];
+		if(entry != nullptr && entry->src == u->get_position() && entry->max_cost == u->get_move()) {
+			++hits_;
+			return entry;
+		}
+		++misses_;
+		// Anyone still holding the old entry keeps it, so make a new one.
+		auto rm = std::make_shared<reachable_moves>();
+		rm->src = u->get_position();
+		rm->max_cost = u->get_move();
+		rm->graph = create_cost_graph(gs, u->get_owner()->team(), rm->src, rm->max_cost);
+		rm->moves = find_available_moves(rm->graph, rm->src, rm->max_cost, &rm->pred, &rm->dist);
+		entry = rm;
+		return entry;
+	}
 
-	// visitor that terminates when we find the goal
-	template<typename Vertex>
-	class astar_goal_visitor : public boost::default_astar_visitor
+	void reachability_cache::prefetch(const game::state& gs, const game::unit_list& units)
 	{
-	public:
-		astar_goal_visitor(Vertex goal) : goal_(goal) {}
-		template<typename Graph> void examine_vertex(Vertex u, Graph& g) {
-			if(u == goal_) {
-				throw found_goal();
+		game::unit_list stale;
+		std::vector<move_request> requests;
+		for(auto& u : units) {
+			auto it = entries_.find(u->get_uuid());
+			if(it != entries_.end() && it->second != nullptr && it->second->src == u->get_position() && it->second->max_cost == u->get_move()) {
+				continue;
 			}
+			stale.emplace_back(u);
+			requests.emplace_back(u->get_position(), u->get_move(), u->get_owner()->team());
 		}
-	private:
-		Vertex goal_;
-	};
+		if(requests.empty()) {
+			return;
+		}
+		auto res = find_all_available_moves(search_view(gs), requests);
+		for(int n = 0; n != static_cast<int>(stale.size()); ++n) {
+			++misses_;
+			entries_[stale[n]->get_uuid()] = std::make_shared<reachable_moves>(std::move(res[n]));
+		}
+	}
 
-	template <class Graph, class CostType>
-	class astar_heuristic : public std::unary_function<typename boost::graph_traits<Graph>::vertex_descriptor, CostType>
-	{
-	public:
-		typedef typename boost::graph_traits<Graph>::vertex_descriptor Vertex;
-		astar_heuristic(Vertex goal, const std::vector<point>& vertices) 
-			: goal_x_(vertices[goal].x), 
-			  goal_y_(vertices[goal].y), 
-			  vertices_(vertices) {}
-		CostType operator()(Vertex u) 
-		{ 
-			const auto u_x = vertices_[u].x;
-			const auto u_y = vertices_[u].y;
-			return static_cast<CostType>((abs(u_x - goal_x_) + abs(u_y - goal_y_) + abs(u_x + u_y - goal_x_ - goal_y_)) / 2.0f);
-		}
-	private:
-		int goal_x_;
-		int goal_y_;
-		const std::vector<point>& vertices_;
-	};
+	void reachability_cache::unit_changed(const point& p)
+	{
+		// A unit changes the overlay of its own tile and the zone of control of the tiles
+		// around it, so anything searched within one tile of p is stale.
+		for(auto it = entries_.begin(); it != entries_.end(); ) {
+			auto& g = it->second->graph;
+			if(g != nullptr && p.x >= g->x - 1 && p.y >= g->y - 1 && p.x <= g->x + g->w && p.y <= g->y + g->h) {
+				++invalidations_;
+				it = entries_.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
 
-	result_path find_path(hex_graph_ptr graph, const point& src, const point& dst)
+	void reachability_cache::tile_changed(const point& p)
 	{
-		//profile::manager pman("find_path");
+		for(auto it = entries_.begin(); it != entries_.end(); ) {
+			if(it->second->graph != nullptr && it->second->graph->contains(p)) {
+				++invalidations_;
+				it = entries_.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
 
-		auto src_it = graph->reverse_map.find(src);
-		ASSERT_LOG(src_it != graph->reverse_map.end(), "source node not in graph.");
-		auto dst_it = graph->reverse_map.find(dst);
-		ASSERT_LOG(dst_it != graph->reverse_map.end(), "destination node not in graph.");
+	void reachability_cache::remove(const uuid::uuid& id)
+	{
+		entries_.erase(id);
+	}
 
-		std::vector<vertex> p(boost::num_vertices(graph->graph));
-		std::vector<cost> d(boost::num_vertices(graph->graph));
-		try {
-			boost::astar_search_tree(graph->graph, src_it->second, astar_heuristic<hex_graph, cost>(dst_it->second, graph->vertices), 
-				boost::predecessor_map(boost::make_iterator_property_map(p.begin(), boost::get(boost::vertex_index, graph->graph))).
-				distance_map(boost::make_iterator_property_map(d.begin(), boost::get(boost::vertex_index, graph->graph))).
-				visitor(astar_goal_visitor<vertex>(dst_it->second)));
-		} catch(found_goal /*fg*/) {
-			result_path shortest_path;
-			for(vertex v = dst_it->second;; v = p[v]) {
-				shortest_path.emplace_back(graph->vertices[v]);
-				if(p[v] == v) {
-					std::reverse(shortest_path.begin(), shortest_path.end());
-					return shortest_path;
+	void reachability_cache::clear()
+	{
+		entries_.clear();
+	}
+}
+
+namespace
+{
+	// Cheapest cost from src to every tile by the movement rules, worked out the slow way:
+	// enemy tiles can't be entered and tiles next to an enemy can't be left, other than src.
+	// -1 for tiles that can't be reached.
+	std::vector<hex::fixed_cost> reference_costs(const game::state& gs, const team_ptr& team, const point& src)
+	{
+		auto& m = *gs.get_map();
+		auto enemy_at = [&](const point& p) {
+			auto& u = gs.get_unit_at(p);
+			return u != nullptr && u->get_owner()->team() != team;
+		};
+		auto in_zoc = [&](const point& p) {
+			auto nr = m.get_neighbors(p);
+			for(auto it = nr.begin(); it != nr.end(); ++it) {
+				if(enemy_at(*it)) {
+					return true;
+				}
+			}
+			return false;
+		};
+		std::vector<hex::fixed_cost> d(m.size(), -1);
+		typedef std::pair<hex::fixed_cost, int> entry;
+		std::priority_queue<entry, std::vector<entry>, std::greater<entry>> open;
+		d[m.index(src)] = 0;
+		open.emplace(0, m.index(src));
+		while(!open.empty()) {
+			const entry top = open.top();
+			open.pop();
+			const point p = m.position(top.second);
+			if(top.first != d[top.second] || (p != src && in_zoc(p))) {
+				continue;
+			}
+			auto nr = m.get_neighbors(p);
+			for(auto it = nr.begin(); it != nr.end(); ++it) {
+				const int n = m.index(*it);
+				const hex::fixed_cost c = top.first + hex::to_fixed_cost(m.type_costs()[m.tile_type(n)]);
+				if(!enemy_at(*it) && (d[n] < 0 || c < d[n])) {
+					d[n] = c;
+					open.emplace(c, n);
 				}
 			}
 		}
-		return result_path();
+		return d;
 	}
 }
+
+UNIT_TEST(pathfinding_test)
+{
+	using namespace game;
+	// Rows of grass, sand and hills, so paths have to choose between short and cheap.
+	std::vector<hex::logical::const_tile_ptr> types;
+	types.emplace_back(std::make_shared<hex::logical::tile>("grass", "Grass", 1.0f, 1.0f));
+	types.emplace_back(std::make_shared<hex::logical::tile>("sand", "Sand", 1.5f, 1.0f));
+	types.emplace_back(std::make_shared<hex::logical::tile>("hills", "Hills", 2.0f, 2.0f));
+	std::vector<hex::logical::map::type_index> tiles;
+	for(int y = 0; y != 8; ++y) {
+		for(int x = 0; x != 10; ++x) {
+			tiles.emplace_back(static_cast<hex::logical::map::type_index>((x * 7 + y * 3 + x * y) % 5 % 3));
+		}
+	}
+	auto m = std::make_shared<hex::logical::map>(10, 8, types, tiles);
+	auto cr = std::make_shared<creature::creature>(json::parse("{\"name\": \"Test\", \"stats\": {\"health\": 10, \"attack\": 5, \"movement\": 4, \"initiative\": 5}, \"animations\": {}}"));
+
+	state gs;
+	gs.set_map(m);
+	auto ta = gs.create_team_instance("a");
+	auto pa = std::make_shared<player>(ta, PlayerType::NORMAL, "a");
+	auto tb = gs.create_team_instance("b");
+	auto pb = std::make_shared<player>(tb, PlayerType::NORMAL, "b");
+	gs.add_player(pa);
+	gs.add_player(pb);
+	auto add = [&](const player_ptr& p, const point& pos) {
+		auto u = std::make_shared<unit>("test", cr, p);
+		u->set_position(pos.x, pos.y);
+		gs.add_unit(u);
+		return u;
+	};
+	const point src(1, 3);
+	add(pa, src);
+	auto friend_unit = add(pa, point(2, 3));
+	unit_list enemies;
+	enemies.emplace_back(add(pb, point(5, 3)));
+	enemies.emplace_back(add(pb, point(6, 6)));
+	const float max_cost = 5.0f;
+	const auto ref = reference_costs(gs, ta, src);
+
+	// Everything within max_cost, less the tile with the other unit on it.
+	auto moves = hex::find_available_moves(hex::create_cost_graph(gs, ta, src, max_cost), src, max_cost);
+	std::vector<hex::fixed_cost> found(m->size(), -1);
+	for(auto& mv : moves) {
+		found[m->index(mv.loc)] = hex::to_fixed_cost(mv.path_cost);
+	}
+	for(int n = 0; n != static_cast<int>(m->size()); ++n) {
+		const bool reachable = ref[n] >= 0 && ref[n] <= hex::to_fixed_cost(max_cost) && m->position(n) != friend_unit->get_position();
+		CHECK_EQ(found[n], reachable ? ref[n] : -1);
+	}
+
+	// The heuristic is admissible, so every path is as cheap as it can be, and follows the rules.
+	auto graph = hex::create_graph(gs, ta);
+	for(int n = 0; n != static_cast<int>(m->size()); ++n) {
+		const point dst = m->position(n);
+		auto path = hex::find_path(graph, src, dst);
+		CHECK_EQ(path.empty() ? -1 : hex::path_cost(*gs.get_graph(), path), ref[n]);
+		for(int i = 1; i < static_cast<int>(path.size()); ++i) {
+			CHECK_EQ(hex::logical::distance(path[i - 1], path[i]), 1);
+			CHECK(i == 1 || !(graph->flags(path[i - 1]) & hex::OVERLAY_ZOC), "path leaves zone of control at " << path[i - 1]);
+		}
+	}
+
+	// Walking the search tree back from any reachable tile gives a path costing what the
+	// search said it would, which is as cheap as find_path() manages.
+	auto cost_graph = hex::create_cost_graph(gs, ta, src, max_cost);
+	std::vector<int> pred;
+	std::vector<hex::fixed_cost> dist;
+	for(auto& mv : hex::find_available_moves(cost_graph, src, max_cost, &pred, &dist)) {
+		auto path = hex::get_path(*cost_graph, pred, mv.loc);
+		CHECK(!path.empty() && path.front() == src && path.back() == mv.loc, "bad path from " << src << " to " << mv.loc);
+		CHECK_EQ(hex::path_cost(*gs.get_graph(), path), dist[cost_graph->local_index(mv.loc)]);
+		CHECK_EQ(hex::path_cost(*gs.get_graph(), path), hex::path_cost(*gs.get_graph(), hex::find_path(graph, src, mv.loc)));
+	}
+
+	// Searching in parallel gives the same results as searching one at a time.
+	std::vector<hex::move_request> requests;
+	requests.emplace_back(src, max_cost, ta);
+	requests.emplace_back(src, 2.5f, ta);
+	for(auto& e : enemies) {
+		requests.emplace_back(e->get_position(), max_cost, tb);
+	}
+	auto all = hex::find_all_available_moves(hex::search_view(gs), requests);
+	CHECK_EQ(all.size(), requests.size());
+	for(int n = 0; n != static_cast<int>(requests.size()); ++n) {
+		auto& req = requests[n];
+		auto g = hex::create_cost_graph(gs, req.team, req.src, req.max_cost);
+		std::vector<int> p;
+		std::vector<hex::fixed_cost> d;
+		auto moves = hex::find_available_moves(g, req.src, req.max_cost, &p, &d);
+		CHECK_EQ(all[n].src, req.src);
+		CHECK_EQ(all[n].moves.size(), moves.size());
+		for(int i = 0; i != static_cast<int>(moves.size()) && i != static_cast<int>(all[n].moves.size()); ++i) {
+			CHECK_EQ(all[n].moves[i].loc, moves[i].loc);
+			CHECK_EQ(all[n].moves[i].path_cost, moves[i].path_cost);
+		}
+		CHECK(all[n].pred == p && all[n].dist == d, "search tree from " << req.src << " differs");
+		CHECK(all[n].graph->overlay == g->overlay, "overlay around " << req.src << " differs");
+	}
+
+	// The cheapest tile in range of each enemy that can be stopped on and has nothing in the
+	// way of the target. Returns how many tiles were left out for having something in the way.
+	auto check_attacks = [&](int range) {
+		auto cost_graph = hex::create_cost_graph(gs, ta, src, max_cost);
+		std::vector<hex::fixed_cost> cost(m->size(), -1);
+		for(auto& mv : hex::find_available_moves(cost_graph, src, max_cost)) {
+			cost[m->index(mv.loc)] = hex::to_fixed_cost(mv.path_cost);
+		}
+		auto blocked = [&](const point& from, const point& to) {
+			return hex::line_blocked(from, to, [&](const point& p) { return p != src && gs.get_occupancy().occupied(p); });
+		};
+		int blocked_tiles = 0;
+		auto attacks = hex::find_attack_positions(cost_graph, src, max_cost, range, enemies, gs.get_occupancy());
+		for(auto& e : enemies) {
+			hex::fixed_cost best = -1;
+			for(auto& q : hex::logical::spiral(e->get_position(), range)) {
+				const int n = m->index(q);
+				if(!m->in_bounds(q) || cost[n] < 0) {
+					continue;
+				}
+				if(blocked(q, e->get_position())) {
+					++blocked_tiles;
+				} else if(best < 0 || cost[n] < best) {
+					best = cost[n];
+				}
+			}
+			auto it = std::find_if(attacks.begin(), attacks.end(), [&e](const hex::attack_position& ap) { return ap.target == e; });
+			CHECK_EQ(it == attacks.end() ? -1 : hex::to_fixed_cost(it->path_cost), best);
+			if(it != attacks.end()) {
+				CHECK(hex::logical::distance(it->loc, e->get_position()) <= range, "attack position out of range");
+				CHECK(!blocked(it->loc, e->get_position()), "attack position " << it->loc << " has a unit in the way");
+				CHECK_EQ(hex::path_cost(*gs.get_graph(), it->path), best);
+				CHECK_EQ(it->path.back(), it->loc);
+			}
+		}
+		CHECK_EQ(attacks.size(), enemies.size());
+		return blocked_tiles;
+	};
+	CHECK_EQ(check_attacks(1), 0);
+	// A unit standing next to the first enemy is in the way of some of the tiles two away.
+	add(pa, point(4, 3));
+	CHECK_GT(check_attacks(2), 0);
+}
@@ -16,37 +16,219 @@
 
 #pragma once
 
-#include <tuple>
-#include <boost/graph/astar_search.hpp>
-#include <boost/graph/adjacency_list.hpp>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <vector>
 
 #include "geometry.hpp"
 #include "game_state.hpp"
 #include "hex_logical_fwd.hpp"
+#include "hex_logical_tiles.hpp"
+#include "player.hpp"
+#include "units_fwd.hpp"
+#include "uuid.hpp"
 
 namespace hex
 {
 	typedef float cost;
-	typedef point node_type;
-	typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS, boost::no_property, boost::property<boost::edge_weight_t, cost>> hex_graph;
-	typedef boost::property_map<hex_graph, boost::edge_weight_t>::type WeightMap;
-	typedef hex_graph::vertex_descriptor vertex;
-	typedef hex_graph::edge_descriptor edge_descriptor;
-	typedef std::pair<point, point> edge;
 
+	// Path costs are summed in fixed point, so that the client, the server and the bot all
+	// get exactly the same answer for the cost of a path. Tile costs are in hundredths.
+	typedef int fixed_cost;
+	const fixed_cost fixed_cost_scale = 100;
+	inline fixed_cost to_fixed_cost(float c) { return static_cast<fixed_cost>(std::floor(c * fixed_cost_scale + 0.5f)); }
+	inline float from_fixed_cost(fixed_cost c) { return static_cast<float>(c) / fixed_cost_scale; }
+
+	// Movement costs of a logical map, shared by all queries. Vertices are tile indexes
+	// (y * width + x), each edge is weighted by the cost of entering its target tile.
+	// Nothing is stored per tile: neighbours are worked out from the coordinates and costs 
+	// are read from a snapshot of the map's tiles, so paged maps stay paged. Units and zone of
+	// control are applied on top of it by graph_t. Changes made to the map after the graph
+	// was built don't show up in it.
+	class map_graph
+	{
+	public:
+		explicit map_graph(const logical::map& m);
+
+		int width() const { return width_; }
+		int height() const { return height_; }
+		int size() const { return width_ * height_; }
+
+		bool in_bounds(int xx, int yy) const { return xx >= x_ && yy >= y_ && xx < x_ + width_ && yy < y_ + height_; }
+		bool in_bounds(const point& p) const { return in_bounds(p.x, p.y); }
+		int index(int xx, int yy) const { return (yy - y_) * width_ + (xx - x_); }
+		int index(const point& p) const { return index(p.x, p.y); }
+		point position(int n) const { return point(n % width_ + x_, n / width_ + y_); }
+
+		// Vertices joined to n, use neighbor_iterator::index() for their vertex numbers.
+		logical::neighbor_range neighbors(int n) const { return logical::neighbor_range(n % width_, n / width_, width_, height_, point(x_, y_)); }
+		logical::neighbor_range neighbors(const point& p) const { return logical::neighbor_range(p.x - x_, p.y - y_, width_, height_, point(x_, y_)); }
+
+		fixed_cost tile_cost(int n) const { return type_costs_[tiles_->get(n % width_, n / width_)]; }
+		// As above, saves working out the position in loops that already have it.
+		fixed_cost tile_cost(const point& p) const { return type_costs_[tiles_->get(p.x - x_, p.y - y_)]; }
+		// Costs of the count tiles starting at (xx,yy), along the row. Reads the map a row at a
+		// time, which is quicker than tile_cost() for each, more so on paged maps.
+		void get_row_costs(int xx, int yy, int count, fixed_cost* out) const;
+		// Cheapest tile type on the map, used to keep the A* heuristic admissible.
+		fixed_cost min_cost() const { return min_cost_; }
+		fixed_cost max_cost() const { return max_cost_; }
+		// Largest value that divides every tile cost, all path costs are multiples of this.
+		fixed_cost cost_step() const { return cost_step_; }
+	private:
+		int x_;
+		int y_;
+		int width_;
+		int height_;
+		fixed_cost min_cost_;
+		fixed_cost max_cost_;
+		fixed_cost cost_step_;
+		std::shared_ptr<const logical::chunk_store> tiles_;
+		// Indexed by logical::map::type_index.
+		std::vector<fixed_cost> type_costs_;
+	};
+
+	enum OverlayFlags {
+		// Tile has an enemy unit on it, it can't be entered.
+		OVERLAY_ENEMY		= 1,
+		// Tile is next to an enemy unit, movement stops on entering it.
+		OVERLAY_ZOC			= 2,
+		// Tile has a friendly unit on it, it can be passed through but not stopped on.
+		OVERLAY_OCCUPIED	= 4,
+	};
+
+	// A window over the map_graph for a single query. Unit positions and zone of
+	// control are stored as per-tile overlay flags rather than by removing edges.
 	struct graph_t
 	{
-		graph_t(size_t size) : graph(size) {}
-		hex_graph graph;
-		std::map<point, int> reverse_map;
-		std::vector<point> vertices;
+		graph_t(const map_graph_ptr& g, int x, int y, int w, int h);
+		bool contains(const point& p) const { return p.x >= x && p.y >= y && p.x < x + w && p.y < y + h; }
+		int local_index(const point& p) const { return (p.y - y) * w + (p.x - x); }
+		unsigned char flags(const point& p) const { return overlay[local_index(p)]; }
+		// Copies the costs of the tiles in the window out of the map, so searches don't have to
+		// go back to it for every edge. Worth it for the small windows of create_cost_graph().
+		void load_costs();
+		fixed_cost tile_cost(const point& p, int local) const { return costs.empty() ? base->tile_cost(p) : costs[local]; }
+
+		map_graph_ptr base;
+		int x;
+		int y;
+		int w;
+		int h;
+		std::vector<unsigned char> overlay;
+		// Empty unless load_costs() was called.
+		std::vector<fixed_cost> costs;
 	};
-	typedef std::shared_ptr<graph_t> hex_graph_ptr;
 
-	typedef std::vector<point> result_path;
+	// Copy of the parts of game::state that path finding looks at. Searches made against a
+	// view don't touch the state, so they can be run from other threads. The occupancy and
+	// zone of control indexes are shared rather than copied, so the state mustn't change
+	// while those searches are running.
+	struct search_view
+	{
+		explicit search_view(const game::state& gs);
+		struct unit_info
+		{
+			unit_info(const point& p, const team_ptr& t) : pos(p), team(t) {}
+			point pos;
+			team_ptr team;
+		};
+		map_graph_ptr graph;
+		std::vector<unit_info> units;
+		const game::occupancy* occupancy;
+		const game::zone_of_control* zoc;
+	};
 
+	// Enemy/friendly status in these is relative to the unit whose turn it is, or the team given.
 	hex_graph_ptr create_cost_graph(const game::state& gs, const point& src, float max_cost);
+	hex_graph_ptr create_cost_graph(const game::state& gs, const team_ptr& team, const point& src, float max_cost);
 	hex_graph_ptr create_graph(const game::state& gs, int x=0, int y=0, int w=0, int h=0);
-	result_list find_available_moves(hex_graph_ptr graph, const point& src, float max_cost);
+	hex_graph_ptr create_graph(const game::state& gs, const team_ptr& team, int x=0, int y=0, int w=0, int h=0);
+	hex_graph_ptr create_cost_graph(const search_view& view, const team_ptr& team, const point& src, float max_cost);
+	hex_graph_ptr create_graph(const search_view& view, const team_ptr& team, int x=0, int y=0, int w=0, int h=0);
+	// Tiles reachable from src for at most max_cost. Uses a bucket queue over the fixed point
+	// costs and stops expanding as soon as max_cost is exceeded. If pred/dist are given they
+	// are filled in with the search tree, indexed by graph_t::local_index().
+	result_list find_available_moves(hex_graph_ptr graph, const point& src, float max_cost, std::vector<int>* pred=nullptr, std::vector<fixed_cost>* dist=nullptr);
 	result_path find_path(hex_graph_ptr graph, const point& src, const point& dst);
+	// As above, but writes into path so its storage can be reused. The search itself runs in
+	// scratch memory kept per thread, so repeated calls don't allocate. Returns false if
+	// there's no way to dst.
+	bool find_path(const graph_t& graph, const point& src, const point& dst, result_path* path);
+	// Walks the predecessors left by find_available_moves() back from dst. Empty if dst 
+	// wasn't reached.
+	result_path get_path(const graph_t& graph, const std::vector<int>& pred, const point& dst);
+	struct attack_position
+	{
+		attack_position() : path_cost(0) {}
+		game::unit_ptr target;
+		point loc;
+		float path_cost;
+		result_path path;
+	};
+	typedef std::vector<attack_position> attack_position_list;
+
+	// For each of targets, the cheapest tile reachable from src for at most max_cost that is
+	// within range of the target, with the path to get there. All the targets are handled by a
+	// single search. Targets that can't be reached are left out. As game::state::is_attackable()
+	// does, tiles where the line to the target passes through a unit in occupants don't count,
+	// other than the unit at src, which will have moved.
+	attack_position_list find_attack_positions(hex_graph_ptr graph, const point& src, float max_cost, int range, const game::unit_list& targets, const game::occupancy& occupants);
+	// Cost of moving along path, the first element being the starting tile.
+	fixed_cost path_cost(const map_graph& g, const result_path& path);
+
+	struct reachable_moves
+	{
+		reachable_moves() : max_cost(0) {}
+		point src;
+		float max_cost;
+		hex_graph_ptr graph;
+		result_list moves;
+		// Search tree for moves, see find_available_moves().
+		std::vector<int> pred;
+		std::vector<fixed_cost> dist;
+	};
+
+	struct move_request
+	{
+		move_request(const point& p, float mc, const team_ptr& t) : src(p), max_cost(mc), team(t) {}
+		point src;
+		float max_cost;
+		team_ptr team;
+	};
+	// create_cost_graph() + find_available_moves() for each request, spread over the shared
+	// thread pool. Results are in the same order as the requests.
+	std::vector<reachable_moves> find_all_available_moves(const search_view& view, const std::vector<move_request>& requests);
+
+	// Per-unit cache of create_cost_graph() + find_available_moves(). An entry stays valid
+	// while the unit keeps its position and movement, and nothing happens inside the window 
+	// that was searched (or next to it, since that changes zone of control).
+	// Entries are handed out shared, so they stay usable by whoever has them after the cache
+	// has dropped them.
+	class reachability_cache
+	{
+	public:
+		reachability_cache();
+
+		reachable_moves_ptr get(const game::state& gs, const game::unit_ptr& u);
+		// Brings the entries for all of units up to date, searching for the stale ones in parallel.
+		void prefetch(const game::state& gs, const game::unit_list& units);
+
+		// A unit appeared at, left or died at p.
+		void unit_changed(const point& p);
+		// The cost of the tile at p changed.
+		void tile_changed(const point& p);
+		void remove(const uuid::uuid& id);
+		void clear();
+
+		int hits() const { return hits_; }
+		int misses() const { return misses_; }
+		int invalidations() const { return invalidations_; }
+	private:
+		std::map<uuid::uuid, reachable_moves_ptr> entries_;
+		int hits_;
+		int misses_;
+		int invalidations_;
+	};
 }
@@ -19,7 +19,7 @@
 #include <functional>
 
 #include "asserts.hpp"
-#include "hex_object.hpp"
+#include "hex_map.hpp"
 #include "hex_tile.hpp"
 #include "node_utils.hpp"
 #include "texture.hpp"
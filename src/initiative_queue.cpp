@@ -0,0 +1,268 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <algorithm>
+#include <list>
+
+#include "asserts.hpp"
+#include "initiative_queue.hpp"
+#include "unit_test.hpp"
+#include "units.hpp"
+
+namespace game
+{
+	initiative_queue::initiative_queue()
+		: next_sequence_(0),
+		  low_sequence_(-1)
+	{
+	}
+
+	void initiative_queue::clear()
+	{
+		units_.clear();
+		handles_.clear();
+		sequences_.clear();
+		positions_.clear();
+		next_sequence_ = 0;
+		low_sequence_ = -1;
+	}
+
+	void initiative_queue::push(int handle, const unit_ptr& u)
+	{
+		restore(handle, u, next_sequence_++);
+	}
+
+	void initiative_queue::restore(int handle, const unit_ptr& u, int32_t sequence)
+	{
+		ASSERT_LOG(handle >= 0, "Bad unit handle: " << handle);
+		ASSERT_LOG(!contains(handle), "Unit is already in the initiative queue: " << u);
+		if(handle >= static_cast<int>(positions_.size())) {
+			positions_.resize(handle + 1, -1);
+		}
+		const int n = size();
+		units_.emplace_back(u);
+		handles_.emplace_back(handle);
+		sequences_.emplace_back(sequence);
+		positions_[handle] = n;
+		sift_up(n);
+	}
+
+	void initiative_queue::erase(int handle)
+	{
+		const int n = position(handle);
+		ASSERT_LOG(n >= 0, "Unit handle isn't in the initiative queue: " << handle);
+		const int last = size() - 1;
+		if(n != last) {
+			swap_entries(n, last);
+		}
+		positions_[handle] = -1;
+		units_.pop_back();
+		handles_.pop_back();
+		sequences_.pop_back();
+		if(n != last) {
+			// The entry moved into the hole could need to go either way.
+			const int moved = handles_[n];
+			sift_up(n);
+			sift_down(positions_[moved]);
+		}
+	}
+
+	void initiative_queue::reschedule(int handle)
+	{
+		reschedule(handle, low_sequence_);
+	}
+
+	void initiative_queue::reschedule(int handle, int32_t sequence)
+	{
+		const int n = position(handle);
+		ASSERT_LOG(n >= 0, "Unit handle isn't in the initiative queue: " << handle);
+		sequences_[n] = sequence;
+		next_sequence_ = std::max(next_sequence_, sequence + 1);
+		low_sequence_ = std::min(low_sequence_, sequence - 1);
+		sift_up(n);
+		sift_down(positions_[handle]);
+	}
+
+	int32_t initiative_queue::sequence(int handle) const
+	{
+		const int n = position(handle);
+		ASSERT_LOG(n >= 0, "Unit handle isn't in the initiative queue: " << handle);
+		return sequences_[n];
+	}
+
+	void initiative_queue::copy_order(const initiative_queue& other, const unit_list& units, const std::vector<int>& handles)
+	{
+		ASSERT_LOG(units.size() == other.units_.size() && handles.size() == other.handles_.size(), "Initiative queue copied with the wrong number of units.");
+		units_ = units;
+		handles_ = handles;
+		sequences_ = other.sequences_;
+		next_sequence_ = other.next_sequence_;
+		low_sequence_ = other.low_sequence_;
+		positions_.clear();
+		for(int n = 0; n != size(); ++n) {
+			if(handles_[n] >= static_cast<int>(positions_.size())) {
+				positions_.resize(handles_[n] + 1, -1);
+			}
+			positions_[handles_[n]] = n;
+		}
+	}
+
+	bool initiative_queue::before(int a, int b) const
+	{
+		const float ia = units_[a]->get_initiative();
+		const float ib = units_[b]->get_initiative();
+		if(ia != ib) {
+			return ia < ib;
+		}
+		return sequences_[a] < sequences_[b];
+	}
+
+	void initiative_queue::swap_entries(int a, int b)
+	{
+		std::swap(units_[a], units_[b]);
+		std::swap(handles_[a], handles_[b]);
+		std::swap(sequences_[a], sequences_[b]);
+		positions_[handles_[a]] = a;
+		positions_[handles_[b]] = b;
+	}
+
+	void initiative_queue::sift_up(int n)
+	{
+		while(n > 0) {
+			const int parent = (n - 1) / arity;
+			if(!before(n, parent)) {
+				break;
+			}
+			swap_entries(n, parent);
+			n = parent;
+		}
+	}
+
+	void initiative_queue::sift_down(int n)
+	{
+		const int sz = size();
+		for(;;) {
+			const int first = n * arity + 1;
+			if(first >= sz) {
+				break;
+			}
+			int best = first;
+			for(int c = first + 1; c < first + arity && c < sz; ++c) {
+				if(before(c, best)) {
+					best = c;
+				}
+			}
+			if(!before(best, n)) {
+				break;
+			}
+			swap_entries(n, best);
+			n = best;
+		}
+	}
+}
+
+namespace
+{
+	// Handles in the order the units take their turns.
+	std::vector<int> turn_order(const game::initiative_queue& q, const game::unit_list& by_handle)
+	{
+		std::vector<int> res;
+		for(int h = 0; h != static_cast<int>(by_handle.size()); ++h) {
+			if(q.contains(h)) {
+				res.emplace_back(h);
+			}
+		}
+		std::sort(res.begin(), res.end(), [&](int a, int b) {
+			const float ia = by_handle[a]->get_initiative();
+			const float ib = by_handle[b]->get_initiative();
+			return ia != ib ? ia < ib : q.sequence(a) < q.sequence(b);
+		});
+		return res;
+	}
+}
+
+UNIT_TEST(initiative_queue_test)
+{
+	using namespace game;
+	unit_list units;
+	initiative_queue q;
+	for(float i : { 5.0f, 3.0f, 5.0f, 3.0f, 5.0f }) {
+		units.emplace_back(std::make_shared<unit>("test", nullptr, nullptr));
+		units.back()->set_initiative(i);
+		q.push(static_cast<int>(units.size()) - 1, units.back());
+	}
+	// Equal initiatives go in the order they were added.
+	CHECK(turn_order(q, units) == std::vector<int>({ 1, 3, 0, 2, 4 }), "bad order after push");
+	CHECK_EQ(q.front(), units[1]);
+
+	// A unit that finishes its turn stays ahead of the others with the same initiative.
+	units[1]->set_initiative(5.0f);
+	q.reschedule(1);
+	CHECK(turn_order(q, units) == std::vector<int>({ 3, 1, 0, 2, 4 }), "bad order after reschedule");
+	CHECK_EQ(q.front(), units[3]);
+
+	const int32_t seq = q.sequence(2);
+	const int32_t next = q.next_sequence();
+	const int32_t low = q.low_sequence();
+	q.erase(2);
+	CHECK(!q.contains(2), "erased unit still in the queue");
+	CHECK(turn_order(q, units) == std::vector<int>({ 3, 1, 0, 4 }), "bad order after erase");
+	q.restore(2, units[2], seq);
+	CHECK(turn_order(q, units) == std::vector<int>({ 3, 1, 0, 2, 4 }), "bad order after restore");
+	CHECK_EQ(q.next_sequence(), next);
+	CHECK_EQ(q.low_sequence(), low);
+
+	// Sequence numbers from the server move the unit and are never handed out again here.
+	units[3]->set_initiative(5.0f);
+	q.reschedule(3, next + 10);
+	CHECK_EQ(q.sequence(3), next + 10);
+	CHECK_EQ(q.next_sequence(), next + 11);
+	CHECK(turn_order(q, units) == std::vector<int>({ 1, 0, 2, 4, 3 }), "bad order after server reschedule");
+	q.reschedule(4, low - 10);
+	CHECK_EQ(q.low_sequence(), low - 11);
+	CHECK(turn_order(q, units) == std::vector<int>({ 4, 1, 0, 2, 3 }), "bad order after server reschedule");
+
+	// Units added later go behind everything with the same initiative.
+	units.emplace_back(std::make_shared<unit>("test", nullptr, nullptr));
+	units.back()->set_initiative(5.0f);
+	q.push(5, units.back());
+	CHECK(turn_order(q, units) == std::vector<int>({ 4, 1, 0, 2, 3, 5 }), "bad order after push");
+
+	// The order is the same as stable sorting the whole list each turn, with the unit that
+	// just had its turn at the front, ties included.
+	units.clear();
+	q.clear();
+	std::list<unit_ptr> sorted;
+	for(int n = 0; n != 13; ++n) {
+		units.emplace_back(std::make_shared<unit>("test", nullptr, nullptr));
+		units.back()->set_initiative(static_cast<float>(n % 4));
+		q.push(n, units.back());
+		sorted.emplace_back(units.back());
+	}
+	sorted.sort(initiative_compare);
+	for(int turn = 0; turn != 500; ++turn) {
+		auto& u = q.front();
+		CHECK_EQ(u, sorted.front());
+		const int h = static_cast<int>(std::find(units.begin(), units.end(), u) - units.begin());
+		u->set_initiative(u->get_initiative() + static_cast<float>(h % 3 + 1));
+		q.reschedule(h);
+		sorted.sort(initiative_compare);
+		auto it = sorted.begin();
+		for(int oh : turn_order(q, units)) {
+			CHECK_EQ(units[oh], *it++);
+		}
+	}
+}
@@ -0,0 +1,89 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "units_fwd.hpp"
+
+namespace game
+{
+	// The order in which units take their turns. Units are kept in a 4-ary heap on their
+	// initiative, so the unit whose turn it is is always at the front and moving a unit
+	// after its initiative changes is O(log n). The rest of the list isn't in any order.
+	// A unit that has just had its turn stays ahead of the others with the same initiative,
+	// while units that are added go behind them. This is tracked with a sequence number,
+	// counting up for added units and down for rescheduled ones, which the server sends
+	// along with changes so clients end up with exactly the same order.
+	//
+	// Units are referred to by their handle in game::state.
+	class initiative_queue
+	{
+	public:
+		initiative_queue();
+
+		const unit_list& units() const { return units_; }
+		bool empty() const { return units_.empty(); }
+		int size() const { return static_cast<int>(units_.size()); }
+		const unit_ptr& front() const { return units_.front(); }
+
+		void clear();
+		// Adds u behind any units with the same initiative.
+		void push(int handle, const unit_ptr& u);
+		void erase(int handle);
+		bool contains(int handle) const { return position(handle) >= 0; }
+		// Moves the unit after its initiative changed. It goes ahead of any units with the
+		// same initiative.
+		void reschedule(int handle);
+		// Moves the unit using a sequence number from elsewhere, i.e. the server.
+		void reschedule(int handle, int32_t sequence);
+		int32_t sequence(int handle) const;
+
+		// For putting things back exactly as they were when undoing changes to the state.
+		// restore() adds a unit with the sequence number it had before.
+		void restore(int handle, const unit_ptr& u, int32_t sequence);
+		// Sequence numbers the next push() and reschedule() will use.
+		int32_t next_sequence() const { return next_sequence_; }
+		void set_next_sequence(int32_t n) { next_sequence_ = n; }
+		int32_t low_sequence() const { return low_sequence_; }
+		void set_low_sequence(int32_t n) { low_sequence_ = n; }
+
+		// Copies the order from other, which has the same units but with their handles
+		// mapped through handles[] to the ones used here.
+		void copy_order(const initiative_queue& other, const unit_list& units, const std::vector<int>& handles);
+	private:
+		static const int arity = 4;
+
+		int position(int handle) const {
+			return handle >= 0 && handle < static_cast<int>(positions_.size()) ? positions_[handle] : -1;
+		}
+		bool before(int a, int b) const;
+		void swap_entries(int a, int b);
+		void sift_up(int n);
+		void sift_down(int n);
+
+		// Heap ordered, with the handle and sequence number for each unit alongside.
+		unit_list units_;
+		std::vector<int> handles_;
+		std::vector<int32_t> sequences_;
+		// Position in the heap by handle, -1 if it isn't in the queue.
+		std::vector<int> positions_;
+		int32_t next_sequence_;
+		int32_t low_sequence_;
+	};
+}
@@ -14,11 +14,15 @@
    limitations under the License.
 */
 
+#include <limits>
+
 #include "SDL.h"
 
 #include "component.hpp"
 #include "easing_between_points.hpp"
 #include "engine.hpp"
+#include "hex_distance_batch.hpp"
+#include "hex_tile.hpp"
 #include "input_process.hpp"
 #include "units.hpp"
 
@@ -71,12 +75,22 @@ namespace process
 			// Scan through list of enemy entities and select ones which are in 
 			// range for being attacked.
 			bool opponent_in_range = false;
-			for(auto& e2 : elist) {
-				if((e2->mask & mask) == mask) {
-					if(eng.get_game_state().is_attackable(aggressor_, e2->stat)) {
-						e2->inp->is_attack_target = true;
-						opponent_in_range = true;
-					}
+			std::vector<int> candidates;
+			hex::position_list positions;
+			for(int n = 0; n != static_cast<int>(elist.size()); ++n) {
+				if((elist[n]->mask & mask) == mask) {
+					candidates.emplace_back(n);
+					positions.add(elist[n]->stat->get_position());
+				}
+			}
+			// Cheap range check on everything first, then the full check on what's left.
+			std::vector<int> in_range;
+			hex::within_range(aggressor_->get_position(), aggressor_->get_range(), positions, &in_range);
+			for(int n : in_range) {
+				auto& e2 = elist[candidates[n]];
+				if(eng.get_game_state().is_attackable(aggressor_, e2->stat)) {
+					e2->inp->is_attack_target = true;
+					opponent_in_range = true;
 				}
 			}
 			if(opponent_in_range) {
@@ -101,17 +115,14 @@ namespace process
 				}
 				if(inp->gen_moves) {
 					inp->gen_moves = false;	
-					inp->graph = hex::create_cost_graph(eng.get_game_state(), pos, e->stat->get_move());
-					inp->possible_moves = hex::find_available_moves(inp->graph, pos, e->stat->get_move());
-					// remove tiles that have friendly entities on them, from the results.
-					// XXX this needs to be incorporated into hex::find_available_moves somehow.
-					inp->possible_moves.erase(std::remove_if(inp->possible_moves.begin(), inp->possible_moves.end(), [&elist](const hex::move_cost& mc) {
-						for(auto& e : elist) {
-							if(e->stat && e->stat->get_position() == mc.loc) {
-								return true;
-							}
-						}
-						return false;
+					auto reach = eng.get_game_state().get_reachable_moves(e->stat);
+					inp->graph = reach->graph;
+					inp->possible_moves = reach->moves;
+					inp->move_pred = reach->pred;
+					inp->move_dist = reach->dist;
+					// Tiles with other units on them are already excluded, remove the tile we're standing on.
+					inp->possible_moves.erase(std::remove_if(inp->possible_moves.begin(), inp->possible_moves.end(), [&pos](const hex::move_cost& mc) {
+						return mc.loc == pos;
 					}), inp->possible_moves.end());
 
 					inp->arrow_path.clear();
@@ -195,7 +206,7 @@ namespace process
 								for(auto& t : inp->tile_path) {
 									auto tile = eng.get_map()->get_tile_at(t.x, t.y);
 									ASSERT_LOG(tile != nullptr, "No tile exists at point: " << pp);
-									LOG_DEBUG("tile" << t << ": " << tile->tile()->id() << " : " << tile->tile()->get_cost());
+									LOG_DEBUG("tile" << t << ": " << tile->id() << " : " << tile->get_cost());
 								}
 								// Generate an update move message.
 								auto up = eng.get_game_state().create_update();
@@ -246,13 +257,13 @@ namespace process
 					auto& inp = e->inp;
 					if(!inp->possible_moves.empty() && inp->graph != nullptr) {
 						auto destination_pt = eng.get_map()->get_tile_pos_from_pixel_pos(x, y);
-						if(eng.get_map()->get_tile_at(destination_pt.x, destination_pt.y)) {
-							auto it = std::find_if(inp->possible_moves.begin(), inp->possible_moves.end(), [&destination_pt](hex::move_cost const& mc){
-								return destination_pt == mc.loc;
-							});
-
-							if(it != inp->possible_moves.end()) {
-								inp->tile_path = std::move(hex::find_path(inp->graph, pos, destination_pt));
+						auto& g = *inp->graph;
+						// Same test as for possible_moves: reached, not where we are and nobody else there.
+						if(g.contains(destination_pt) && destination_pt != pos) {
+							const int n = g.local_index(destination_pt);
+							if(inp->move_dist[n] != std::numeric_limits<hex::fixed_cost>::max() && !(g.overlay[n] & hex::OVERLAY_OCCUPIED)) {
+								// Paths come straight out of the search tree, no need to search again.
+								inp->tile_path = hex::get_path(g, inp->move_pred, destination_pt);
 								inp->arrow_path.clear();
 								for(auto& t : inp->tile_path) {
 									auto p = hex::hex_map::get_pixel_pos_from_tile_pos(t.x, t.y) + point(eng.get_tile_size().x/2, eng.get_tile_size().y/2);
@@ -0,0 +1,128 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include "asserts.hpp"
+#include "occupancy.hpp"
+
+namespace game
+{
+	occupancy::occupancy()
+		: x_(0),
+		  y_(0),
+		  w_(0),
+		  h_(0),
+		  free_(-1)
+	{
+	}
+
+	void occupancy::reset(int x, int y, int w, int h)
+	{
+		ASSERT_LOG(w >= 0 && h >= 0, "Bad occupancy size: " << w << "x" << h);
+		x_ = x;
+		y_ = y;
+		w_ = w;
+		h_ = h;
+		heads_.reset(w, h, -1);
+		slots_.clear();
+		free_ = -1;
+	}
+
+	void occupancy::clear()
+	{
+		reset(x_, y_, w_, h_);
+	}
+
+	void occupancy::add(const unit_ptr& u, const team_ptr& t, const point& p)
+	{
+		if(!on_map(p)) {
+			return;
+		}
+		int s = free_;
+		if(s >= 0) {
+			free_ = slots_[s].next;
+		} else {
+			s = static_cast<int>(slots_.size());
+			slots_.emplace_back();
+		}
+		slots_[s].u = u;
+		slots_[s].t = t.get();
+		slots_[s].next = heads_.get(p.x - x_, p.y - y_);
+		heads_.set(p.x - x_, p.y - y_, s);
+	}
+
+	void occupancy::remove(const unit_ptr& u, const point& p)
+	{
+		if(!on_map(p)) {
+			return;
+		}
+		for(int prev = -1, s = head(p); s >= 0; prev = s, s = slots_[s].next) {
+			if(slots_[s].u == u) {
+				if(prev < 0) {
+					heads_.set(p.x - x_, p.y - y_, slots_[s].next);
+				} else {
+					slots_[prev].next = slots_[s].next;
+				}
+				slots_[s].u.reset();
+				slots_[s].t = nullptr;
+				slots_[s].next = free_;
+				free_ = s;
+				return;
+			}
+		}
+		ASSERT_LOG(false, "Unit wasn't in the occupancy index at " << p);
+	}
+
+	void occupancy::move(const unit_ptr& u, const team_ptr& t, const point& from, const point& to)
+	{
+		if(from != to) {
+			remove(u, from);
+			add(u, t, to);
+		}
+	}
+
+	const unit_ptr& occupancy::unit_at(const point& p) const
+	{
+		static const unit_ptr none;
+		const int s = head(p);
+		return s < 0 ? none : slots_[s].u;
+	}
+
+	const team* occupancy::team_at(const point& p) const
+	{
+		const int s = head(p);
+		return s < 0 ? nullptr : slots_[s].t;
+	}
+
+	bool occupancy::has_enemy(const point& p, const team* t) const
+	{
+		for(int s = head(p); s >= 0; s = slots_[s].next) {
+			if(slots_[s].t != t) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool occupancy::has_team(const point& p, const team* t) const
+	{
+		for(int s = head(p); s >= 0; s = slots_[s].next) {
+			if(slots_[s].t == t) {
+				return true;
+			}
+		}
+		return false;
+	}
+}
@@ -0,0 +1,92 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "hex_iterators.hpp"
+#include "player.hpp"
+#include "sparse_grid.hpp"
+#include "units_fwd.hpp"
+
+namespace game
+{
+	// Which units are standing on each tile of the map, so that finding what is on a tile
+	// doesn't mean looking through every unit. Units normally have a tile each, but nothing
+	// stops two being put on the same one, so each tile holds a short list.
+	// Only the parts of the map with units on them are stored, so big maps don't cost more.
+	class occupancy
+	{
+	public:
+		occupancy();
+
+		// Empties the index and sets it to cover a w x h map with its top left at (x,y).
+		void reset(int x, int y, int w, int h);
+		void clear();
+
+		// Positions off the map are ignored.
+		void add(const unit_ptr& u, const team_ptr& t, const point& p);
+		void remove(const unit_ptr& u, const point& p);
+		void move(const unit_ptr& u, const team_ptr& t, const point& from, const point& to);
+
+		bool occupied(const point& p) const { return head(p) >= 0; }
+		// The (first) unit on p, or null.
+		const unit_ptr& unit_at(const point& p) const;
+		// Team of the (first) unit on p, or null.
+		const team* team_at(const point& p) const;
+		// Whether there is a unit on p which isn't on team t.
+		bool has_enemy(const point& p, const team* t) const;
+		// Whether there is a unit on p which is on team t.
+		bool has_team(const point& p, const team* t) const;
+
+		// Calls fn(const unit_ptr&) for each unit on p.
+		template<typename F>
+		void for_each_at(const point& p, F fn) const {
+			for(int s = head(p); s >= 0; s = slots_[s].next) {
+				fn(slots_[s].u);
+			}
+		}
+		// Calls fn(const unit_ptr&) for each unit within range of p, nearest tiles first.
+		template<typename F>
+		void for_each_in_range(const point& p, int range, F fn) const {
+			for(auto& rp : hex::logical::spiral(p, range)) {
+				for_each_at(rp, fn);
+			}
+		}
+	private:
+		struct slot
+		{
+			unit_ptr u;
+			const team* t;
+			// Next slot on the same tile, or the next free slot.
+			int next;
+		};
+
+		bool on_map(const point& p) const { return p.x >= x_ && p.y >= y_ && p.x < x_ + w_ && p.y < y_ + h_; }
+		int head(const point& p) const { return on_map(p) ? heads_.get(p.x - x_, p.y - y_) : -1; }
+
+		int x_;
+		int y_;
+		int w_;
+		int h_;
+		// First slot for each tile, -1 if there's no unit on it.
+		sparse_grid<int> heads_;
+		std::vector<slot> slots_;
+		int free_;
+	};
+}
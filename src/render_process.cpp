@@ -24,11 +24,11 @@ namespace process
 {
 	namespace
 	{
-		void draw_position_text(SDL_Renderer* r, int w, int h, const hex::hex_object* tile)
+		void draw_position_text(SDL_Renderer* r, int w, int h, const point& tile)
 		{
 			font::font_ptr fnt = font::get_font("SourceCodePro-Regular.ttf", 12);
 			std::stringstream ss1;
-			ss1 << "Tile under mouse: " << tile->x() << ", " << tile->y();
+			ss1 << "Tile under mouse: " << tile.x << ", " << tile.y;
 			auto surf = font::render_shaded(ss1.str(), fnt, graphics::color(1.0f, 1.0f, 0.5f), graphics::color(0, 0, 0));
 			auto tex = SDL_CreateTextureFromSurface(r, surf);
 			SDL_Rect dst = {0, h - surf->h, surf->w, surf->h};
@@ -63,7 +63,8 @@ namespace process
 
 		hex::hex_map_ptr game_map = eng.get_map();
 		if(game_map) {
-			game_map->draw(rect(0, 0, eng.get_window().width(), eng.get_window().height()), cam);
+			// The renderer is scaled by zoom, so this is the area that ends up on screen.
+			game_map->draw(rect(0, 0, static_cast<int>(eng.get_window().width() / zoom), static_cast<int>(eng.get_window().height() / zoom)), cam);
 		}
 
 		for(auto& e : elist) {
@@ -178,11 +179,11 @@ namespace process
 			SDL_GetMouseState(&x, &y);
 			x = static_cast<int>(x / eng.get_zoom());
 			y = static_cast<int>(y / eng.get_zoom());
-			auto tile_pos = game_map->get_tile_from_pixel_pos(x + cam.x, y + cam.y);
-			//std::cerr << "XXX: (" << x << "," << y << "), (" << cam.x << "," << cam.y << "), (" << tile_pos->x() << "," << tile_pos->y() << ")\n";
-			if(tile_pos) {
+			const point tile_pos = game_map->get_tile_pos_from_pixel_pos(x + cam.x, y + cam.y);
+			//std::cerr << "XXX: (" << x << "," << y << "), (" << cam.x << "," << cam.y << "), (" << tile_pos.x << "," << tile_pos.y << ")\n";
+			if(game_map->get_tile_at(tile_pos.x, tile_pos.y)) {
 				static auto overlay = graphics::texture("images/misc/overlay1.png", graphics::TextureFlags::NONE);
-				point p = game_map->get_pixel_pos_from_tile_pos(tile_pos->x(), tile_pos->y());
+				point p = game_map->get_pixel_pos_from_tile_pos(tile_pos.x, tile_pos.y);
 				overlay.blit(rect(p.x - cam.x, p.y - cam.y, ts.x, ts.y));
 				SDL_RenderSetScale(eng.get_renderer(), 1.0f, 1.0f);
 				draw_position_text(eng.get_renderer(), eng.get_window().width(), eng.get_window().height(), tile_pos);
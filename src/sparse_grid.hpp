@@ -0,0 +1,75 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include <vector>
+
+// A value for each tile of a width x height map where nearly every tile has the same value.
+// Tiles are grouped into square blocks, and only blocks holding some other value are stored,
+// so a big map with a few units on it costs little. Reads are as cheap as for a plain array.
+template<typename T>
+class sparse_grid
+{
+public:
+	static const int block_size = 16;
+
+	sparse_grid() : blocks_x_(0), empty_() {}
+
+	// Every tile set to empty.
+	void reset(int width, int height, const T& empty) {
+		blocks_x_ = (width + block_size - 1) / block_size;
+		empty_ = empty;
+		blocks_.clear();
+		blocks_.resize(blocks_x_ * ((height + block_size - 1) / block_size));
+	}
+
+	// (lx,ly) are relative to the top left of the map, and must be on it.
+	const T& get(int lx, int ly) const {
+		const block& b = blocks_[block_of(lx, ly)];
+		return b.values.empty() ? empty_ : b.values[offset_in_block(lx, ly)];
+	}
+	void set(int lx, int ly, const T& value) {
+		block& b = blocks_[block_of(lx, ly)];
+		if(b.values.empty()) {
+			if(value == empty_) {
+				return;
+			}
+			b.values.assign(block_size * block_size, empty_);
+		}
+		T& v = b.values[offset_in_block(lx, ly)];
+		b.used += (v == empty_ ? 1 : 0) - (value == empty_ ? 1 : 0);
+		v = value;
+		if(b.used == 0) {
+			std::vector<T>().swap(b.values);
+		}
+	}
+private:
+	struct block
+	{
+		block() : used(0) {}
+		// Empty unless some tile in the block isn't empty_.
+		std::vector<T> values;
+		int used;
+	};
+
+	int block_of(int lx, int ly) const { return (ly / block_size) * blocks_x_ + lx / block_size; }
+	static int offset_in_block(int lx, int ly) { return (ly % block_size) * block_size + lx % block_size; }
+
+	int blocks_x_;
+	T empty_;
+	std::vector<block> blocks_;
+};
@@ -0,0 +1,200 @@
+/*
+   Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "asserts.hpp"
+#include "thread_pool.hpp"
+#include "unit_test.hpp"
+
+namespace threading
+{
+	namespace
+	{
+		// VS2013 has no thread_local, see hex_pathfinding.cpp.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+		__declspec(thread) bool is_worker = false;
+		__declspec(thread) bool in_job = false;
+#else
+		thread_local bool is_worker = false;
+		thread_local bool in_job = false;
+#endif
+	}
+
+	bool on_pool_worker()
+	{
+		return is_worker;
+	}
+
+	pool::pool(int nthreads)
+		: quit_(false),
+		  generation_(0),
+		  busy_(0),
+		  fn_(nullptr),
+		  count_(0),
+		  next_(0)
+	{
+		if(nthreads <= 0) {
+			// hardware_concurrency() is allowed to return 0 if it doesn't know.
+			nthreads = std::max(static_cast<int>(std::thread::hardware_concurrency()) - 1, 1);
+		}
+		for(int n = 0; n != nthreads; ++n) {
+			workers_.emplace_back(&pool::worker, this);
+		}
+	}
+
+	pool::~pool()
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			quit_ = true;
+		}
+		start_cv_.notify_all();
+		for(auto& t : workers_) {
+			t.join();
+		}
+	}
+
+	pool& pool::get()
+	{
+		static pool res;
+		return res;
+	}
+
+	void pool::run_jobs()
+	{
+		in_job = true;
+		try {
+			for(int n = next_++; n < count_; n = next_++) {
+				(*fn_)(n);
+			}
+		} catch(...) {
+			job_failed(std::current_exception());
+		}
+		in_job = false;
+	}
+
+	void pool::job_failed(std::exception_ptr e)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if(error_ == nullptr) {
+			error_ = e;
+		}
+		next_ = count_;
+	}
+
+	void pool::worker()
+	{
+		is_worker = true;
+		int seen = 0;
+		for(;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				start_cv_.wait(lock, [&]() { return quit_ || generation_ != seen; });
+				if(quit_) {
+					return;
+				}
+				seen = generation_;
+				++busy_;
+			}
+			run_jobs();
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				--busy_;
+			}
+			done_cv_.notify_all();
+		}
+	}
+
+	void pool::parallel_for(int count, const std::function<void(int)>& fn)
+	{
+		if(count <= 0) {
+			return;
+		}
+		if(count == 1 || in_job) {
+			// Called from a job, which would be waiting on itself for run_mutex_.
+			for(int n = 0; n != count; ++n) {
+				fn(n);
+			}
+			return;
+		}
+		std::unique_lock<std::mutex> run_lock(run_mutex_);
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			// A worker that woke up late for the last job could still be looking at it.
+			done_cv_.wait(lock, [&]() { return busy_ == 0; });
+			fn_ = &fn;
+			count_ = count;
+			next_ = 0;
+			error_ = nullptr;
+			++generation_;
+		}
+		start_cv_.notify_all();
+		run_jobs();
+		// Wait for any workers that are still in the middle of a call.
+		std::exception_ptr error;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			done_cv_.wait(lock, [&]() { return busy_ == 0; });
+			std::swap(error, error_);
+		}
+		if(error != nullptr) {
+			try {
+				std::rethrow_exception(error);
+			} catch(const assert_failure&) {
+				// The assert has been logged by the worker, exit here where it's safe to.
+				ASSERT_EXIT();
+			}
+		}
+	}
+}
+
+UNIT_TEST(thread_pool_test)
+{
+	threading::pool p(3);
+	std::vector<int> calls(100, 0);
+	p.parallel_for(100, [&](int n) { ++calls[n]; });
+	CHECK(std::count(calls.begin(), calls.end(), 1) == 100, "not every job ran exactly once");
+
+	// Nested calls run on the calling thread rather than waiting on the pool they're in.
+	std::vector<std::atomic<int>> inner(20);
+	p.parallel_for(20, [&](int n) {
+		inner[n] = 0;
+		p.parallel_for(10, [&](int m) { inner[n] += m; });
+	});
+	for(auto& v : inner) {
+		CHECK_EQ(v.load(), 45);
+	}
+
+	// An exception thrown by a job reaches the caller.
+	bool caught = false;
+	try {
+		p.parallel_for(1000, [&](int n) {
+			if(n == 5) {
+				throw std::runtime_error("job failed");
+			}
+		});
+	} catch(const std::runtime_error& e) {
+		caught = std::string(e.what()) == "job failed";
+	}
+	CHECK(caught, "exception from a job wasn't passed on");
+
+	// And the pool can still be used afterwards.
+	std::atomic<int> total(0);
+	p.parallel_for(50, [&](int n) { total += n; });
+	CHECK_EQ(total.load(), 1225);
+}
@@ -0,0 +1,73 @@
+/*
+   Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace threading
+{
+	// Fixed set of worker threads for splitting up CPU bound work.
+	class pool
+	{
+	public:
+		// Zero threads means one per hardware thread, less the one calling parallel_for().
+		explicit pool(int nthreads=0);
+		~pool();
+
+		// Calls fn(n) for every n in [0, count), spread over the workers and the calling
+		// thread. Returns when all the calls are done. fn must be safe to call concurrently.
+		// Calls made from inside fn run on the calling thread. If a call throws no more are
+		// started, and the exception is rethrown here once the others have finished.
+		void parallel_for(int count, const std::function<void(int)>& fn);
+
+		int size() const { return static_cast<int>(workers_.size()); }
+
+		// Pool shared by everything in the process.
+		static pool& get();
+	private:
+		void worker();
+		void run_jobs();
+		// Keeps the first exception thrown by a job and stops handing out jobs.
+		void job_failed(std::exception_ptr e);
+
+		std::vector<std::thread> workers_;
+		// Only one parallel_for() at a time.
+		std::mutex run_mutex_;
+
+		std::mutex mutex_;
+		std::condition_variable start_cv_;
+		std::condition_variable done_cv_;
+		bool quit_;
+		// Incremented for every parallel_for(), so the workers can tell when there is new work.
+		int generation_;
+		int busy_;
+
+		const std::function<void(int)>* fn_;
+		int count_;
+		std::atomic<int> next_;
+		std::exception_ptr error_;
+
+		pool(const pool&) = delete;
+		void operator=(const pool&) = delete;
+	};
+}
@@ -46,7 +46,7 @@ namespace game
 		// And should definitely included a scripted component.
 	}
 
-	void unit::complete_turn(Update_UnitStats* uus)
+	void unit::complete_turn()
 	{
 		// reset the movement for the unit at the front of the list.
 		move_ = type_->get_movement();
@@ -55,7 +55,11 @@ namespace game
 		// update the unit at the front of the list initiative.
 		initiative_ += 100.0f / type_->get_initiative();
 		// XXX add more things as required here to complete the units turn.
+	}
 
+	void unit::complete_turn(Update_UnitStats* uus)
+	{
+		complete_turn();
 		uus->set_move(move_);
 		uus->set_attacks_this_turn(attacks_this_turn_);
 		uus->set_initiative(initiative_);
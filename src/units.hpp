@@ -20,6 +20,7 @@
 
 #include "creature_fwd.hpp"
 #include "geometry.hpp"
+#include "message_format.pb.h"
 #include "player.hpp"
 #include "units_fwd.hpp"
 #include "uuid.hpp"
@@ -66,6 +67,8 @@ namespace game
 		void start_turn(Update_UnitStats* uus);
 		// Called at the end of a unit's turn to do end of turn activities.
 		// such as resetting movement counts, initiative, etc.
+		void complete_turn();
+		// As above, filling in uus with the changed stats.
 		void complete_turn(Update_UnitStats* uus);
 
 		const creature::const_creature_ptr& get_type() const { return type_; }
@@ -17,17 +17,20 @@
 #pragma once
 
 #include <functional>
+#include <string>
 #include <vector>
 
-#define UTILITY(name) \
-    void UTILITY_##name(const std::vector<std::string>& args); \
-	static int UTILITY_VAR_##name = utility::register_utility(#name, UTILITY_##name, true); \
-	void UTILITY_##name(const std::vector<std::string>& args)
-
-#define COMMAND_LINE_UTILITY(name) \
-    void UTILITY_##name(const std::vector<std::string>& args); \
-	static int UTILITY_VAR_##name = utility::register_utility(#name, UTILITY_##name, false); \
-	void UTILITY_##name(const std::vector<std::string>& args)
+// name is the string given to --utility=, so it can be anything, e.g. "bench-paths". The
+// function is named after the line the macro is used on.
+#define UTILITY(name) UTILITY_DEFINE(name, true, UTILITY_CONCAT(UTILITY_, __LINE__))
+#define COMMAND_LINE_UTILITY(name) UTILITY_DEFINE(name, false, UTILITY_CONCAT(UTILITY_, __LINE__))
+
+#define UTILITY_CONCAT2(a, b) a##b
+#define UTILITY_CONCAT(a, b) UTILITY_CONCAT2(a, b)
+#define UTILITY_DEFINE(name, needs_video, fn) \
+	static void fn(const std::vector<std::string>& args); \
+	static int UTILITY_CONCAT(fn, _VAR) = utility::register_utility(name, fn, needs_video); \
+	static void fn(const std::vector<std::string>& args)
 
 namespace utility
 {
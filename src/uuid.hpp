@@ -14,6 +14,9 @@
    limitations under the License.
 */
 
+#pragma once
+
+#include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 
 namespace uuid
@@ -23,6 +26,12 @@ namespace uuid
 	uuid generate();
 	std::string write(const uuid& uid);
 	uuid read(const std::string& s);
+
+	// So ids can be used as keys in unordered containers.
+	struct hash
+	{
+		std::size_t operator()(const uuid& id) const { return boost::uuids::hash_value(id); }
+	};
 }
 
 std::ostream& operator<<(std::ostream& os, const uuid::uuid& uid);
@@ -0,0 +1,89 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#include <limits>
+
+#include "asserts.hpp"
+#include "hex_iterators.hpp"
+#include "zone_of_control.hpp"
+
+namespace game
+{
+	zone_of_control::zone_of_control()
+		: x_(0),
+		  y_(0),
+		  w_(0),
+		  h_(0)
+	{
+	}
+
+	void zone_of_control::reset(int x, int y, int w, int h)
+	{
+		ASSERT_LOG(w >= 0 && h >= 0, "Bad zone of control size: " << w << "x" << h);
+		x_ = x;
+		y_ = y;
+		w_ = w;
+		h_ = h;
+		total_.reset(w, h, 0);
+		teams_.clear();
+		counts_.clear();
+	}
+
+	void zone_of_control::move(const team* t, const point& from, const point& to)
+	{
+		if(from != to) {
+			cover(t, from, -1);
+			cover(t, to, 1);
+		}
+	}
+
+	void zone_of_control::cover(const team* t, const point& p, int delta)
+	{
+		if(!on_map(p)) {
+			return;
+		}
+		int slot = 0;
+		while(slot != static_cast<int>(teams_.size()) && teams_[slot] != t) {
+			++slot;
+		}
+		if(slot == static_cast<int>(teams_.size())) {
+			ASSERT_LOG(delta > 0, "Removing a unit from a team with nothing in the zone of control.");
+			teams_.emplace_back(t);
+			counts_.emplace_back();
+			counts_.back().reset(w_, h_, 0);
+		}
+		auto& counts = counts_[slot];
+		auto nr = hex::logical::neighbor_range(p.x - x_, p.y - y_, w_, h_, point(x_, y_));
+		for(auto it = nr.begin(); it != nr.end(); ++it) {
+			const int lx = (*it).x - x_;
+			const int ly = (*it).y - y_;
+			const int total = total_.get(lx, ly) + delta;
+			ASSERT_LOG(total >= 0 && total <= std::numeric_limits<uint8_t>::max(), "Zone of control count out of range at " << *it);
+			total_.set(lx, ly, static_cast<uint8_t>(total));
+			counts.set(lx, ly, static_cast<uint8_t>(counts.get(lx, ly) + delta));
+		}
+	}
+
+	int zone_of_control::team_count(const team* t, int lx, int ly) const
+	{
+		for(int slot = 0; slot != static_cast<int>(teams_.size()); ++slot) {
+			if(teams_[slot] == t) {
+				return counts_[slot].get(lx, ly);
+			}
+		}
+		return 0;
+	}
+}
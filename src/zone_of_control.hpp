@@ -0,0 +1,69 @@
+/*
+	Copyright 2014 Kristina Simpson <sweet.kristas@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "geometry.hpp"
+#include "player.hpp"
+#include "sparse_grid.hpp"
+
+namespace game
+{
+	// How many units of each team are next to each tile of the map. A tile is under zone of
+	// control for a team if there are any units from other teams next to it. Kept up to
+	// date as units move, rather than being worked out from the unit list for every search.
+	// Counts are only stored for the parts of the map with units on them.
+	class zone_of_control
+	{
+	public:
+		zone_of_control();
+
+		// Empties the counts and sets them to cover a w x h map with its top left at (x,y).
+		void reset(int x, int y, int w, int h);
+
+		// A unit on team t arrived at or left p. Positions off the map are ignored.
+		void add(const team* t, const point& p) { cover(t, p, 1); }
+		void remove(const team* t, const point& p) { cover(t, p, -1); }
+		void move(const team* t, const point& from, const point& to);
+
+		// Whether p is next to a unit that isn't on team t.
+		bool under_enemy_zoc(const point& p, const team* t) const {
+			if(!on_map(p)) {
+				return false;
+			}
+			const int total = total_.get(p.x - x_, p.y - y_);
+			return total != 0 && total != team_count(t, p.x - x_, p.y - y_);
+		}
+	private:
+		void cover(const team* t, const point& p, int delta);
+		int team_count(const team* t, int lx, int ly) const;
+
+		bool on_map(const point& p) const { return p.x >= x_ && p.y >= y_ && p.x < x_ + w_ && p.y < y_ + h_; }
+
+		int x_;
+		int y_;
+		int w_;
+		int h_;
+		// Units of any team next to each tile.
+		sparse_grid<uint8_t> total_;
+		// Units of teams_[n] next to each tile are in counts_[n].
+		std::vector<const team*> teams_;
+		std::vector<sparse_grid<uint8_t>> counts_;
+	};
+}